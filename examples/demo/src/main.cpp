@@ -49,6 +49,8 @@
 #include <stdio.h>
 #include <tft_io.hpp>
 #include <ssd1306.hpp>
+#include <ssd1306_glyphs.hpp>
+#include <ssd1306_image_cache.hpp>
 #include <gfx_cpp14.hpp>
 #include "Bm437_Acer_VGA_8x8.h"
 #include "image3.h"
@@ -71,12 +73,22 @@ lcd_type lcd;
 
 using lcd_color = color<typename lcd_type::pixel_type>;
 
+// converts each glyph to the panel's page format once
+ssd1306_glyph_cache<lcd_type> glyphs;
+// keeps the decoded JPEG so it's only decoded once. The gray levels are
+// cached, so toggling dithering only changes how they're sent
+ssd1306_image_cache<lcd_type> images;
+
 using bmp_type = bitmap<rgb_pixel<16>>;
 using bmp_color = color<typename bmp_type::pixel_type>;
 // declare the bitmap
 constexpr static const size16 bmp_size(16,16);
 uint8_t bmp_buf[bmp_type::sizeof_buffer(bmp_size)];
 bmp_type bmp(bmp_size,bmp_buf);
+// the bitmap, pre-packed with a mask so drawing it skips the color key
+uint8_t bmp_bits[lcd_type::masked_image_size(bmp_size)];
+uint8_t bmp_mask[lcd_type::masked_image_size(bmp_size)];
+ssd1306_masked_image bmp_image;
 void bmp_demo() {
     lcd.clear(lcd.bounds());
     
@@ -118,6 +130,8 @@ void bmp_demo() {
                     mouth_bounds.y2);
 
     draw::ellipse(bmp,mouth_bounds,bmp_color::black,&mouth_clip);
+    // build the mask from the transparent color once
+    lcd_type::make_masked_image(bmp,tpx,bmp_bits,bmp_mask,&bmp_image);
     int dx = 1;
     int dy=2;
     lcd.clear(lcd.bounds());
@@ -138,7 +152,7 @@ void bmp_demo() {
             r=r.offset(dx,dy);
         } else
             r=r2;
-        draw::bitmap(lcd,r,bmp,bmp.bounds(),bitmap_resize::crop,&tpx);
+        lcd.image(bmp_image,spoint16(r.x1,r.y1));
 #ifdef SUSPEND_RESUME
         draw::resume(lcd);
 #endif
@@ -167,9 +181,9 @@ void scroll_text_demo() {
         }
 
         text_rect=text_rect.offset(2,0);
-        draw::text(lcd,text_rect,text,f,lcd_color::old_lace,lcd_color::black,false);
+        glyphs.text(lcd,spoint16(text_rect.x1,text_rect.y1),text,f,lcd_color::old_lace,lcd_color::black,false);
         if(text_rect.x2>=lcd.dimensions().width){
-            draw::text(lcd,text_rect.offset(-lcd.dimensions().width,0),text,f,lcd_color::old_lace,lcd_color::black,false);
+            glyphs.text(lcd,spoint16(text_rect.x1-lcd.dimensions().width,text_rect.y1),text,f,lcd_color::old_lace,lcd_color::black,false);
         }
         if(text_rect.x1>=lcd.dimensions().width) {
             text_rect=text_rect.offset(-lcd.dimensions().width,0);
@@ -204,10 +218,11 @@ void lines_demo() {
                 lcd_type::width-i*(lcd_type::width/100.0)-1,
                 lcd_type::height-i*(lcd_type::height/100.0)-1);
 
-        draw::line(lcd,srect16(0,r.y1,r.x1,lcd_type::height-1),lcd_color::red);
-        draw::line(lcd,srect16(r.x2,0,lcd_type::width-1,r.y2),lcd_color::blue);
-        draw::line(lcd,srect16(0,r.y2,r.x1,0),lcd_color::orange);
-        draw::line(lcd,srect16(lcd_type::width-1,r.y1,r.x2,lcd_type::height-1),lcd_color::green);
+        // the driver's native lines step straight through the frame buffer
+        lcd.line(srect16(0,r.y1,r.x1,lcd_type::height-1),lcd_color::red);
+        lcd.line(srect16(r.x2,0,lcd_type::width-1,r.y2),lcd_color::blue);
+        lcd.line(srect16(0,r.y2,r.x1,0),lcd_color::orange);
+        lcd.line(srect16(lcd_type::width-1,r.y1,r.x2,lcd_type::height-1),lcd_color::green);
 #ifdef SUSPEND_RESUME
         draw::resume(lcd);
 #endif
@@ -269,7 +284,13 @@ void loop() {
     scroll_text_demo();
     bmp_demo();
     image3_jpg_stream.seek(0);
-    draw::image(lcd,srect16(0,0,335,255).center((srect16)lcd.bounds()),&image3_jpg_stream);
+    const srect16 image_rect = srect16(0,0,335,255).center((srect16)lcd.bounds());
+    images.draw(lcd,&image3_jpg_stream,image_rect,[&image_rect]() {
+        // decode straight into the frame buffer, skipping what's off screen
+        lcd_type::image_sink sink(lcd,image_rect);
+        jpeg_image::load(&image3_jpg_stream,lcd_type::image_sink::callback,&sink);
+        return sink.finish();
+    });
     delay(2000);
     lcd.dithering(!lcd.dithering());
 }
@@ -1,8 +1,141 @@
+#ifndef HTCW_SSD1306_HPP
+#define HTCW_SSD1306_HPP
 #include <tft_driver.hpp>
 #include <gfx_pixel.hpp>
 #include <gfx_positioning.hpp>
 #include <gfx_bitmap.hpp>
+#ifdef __cpp_impl_coroutine
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define SSD1306_COROUTINES
+#endif
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#define SSD1306_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SSD1306_NEON
+#endif
 namespace arduino {
+    // controls when drawing is sent to the panel
+    enum struct ssd1306_update_mode {
+        // every drawing call is flushed as soon as it completes
+        immediate = 0,
+        // like immediate, but runs of point() calls are batched. Pending
+        // points go out with the next drawing call, resume(), flush() or
+        // service() after batch_timeout(), so call one of those after the
+        // last point
+        coalesced,
+        // drawing only marks damage. call flush() to send it
+        manual
+    };
+    // how drawing combines with what's already in the frame buffer. Each
+    // bit plane is combined separately
+    enum struct ssd1306_raster_op {
+        // replaces the destination
+        copy = 0,
+        // ANDs the source into the destination
+        bit_and,
+        // ORs the source into the destination
+        bit_or,
+        // XORs the source into the destination. Drawing twice restores it
+        bit_xor,
+        // inverts the destination, ignoring the source
+        invert
+    };
+    // how grayscale frame buffers are shown. Temporal modes cycle the bit
+    // planes onto the panel from service(), so the eye averages them into
+    // real gray levels
+    enum struct ssd1306_temporal_mode {
+        // pages are dithered or thresholded to 1 bit
+        off = 0,
+        // each plane is shown for twice as long as the one below it
+        time_weighted,
+        // each plane is shown for one period, with the contrast scaled
+        // by its weight
+        contrast_weighted
+    };
+    // a 1-bit image stored in the panel's page format: a row of bytes per
+    // 8 lines, LSB on top, in PROGMEM. The pages are laid out for the
+    // given rotation, so they can be copied straight into a display with
+    // the same rotation. Use tools/ssd1306_convert to produce these
+    struct ssd1306_image {
+        // the page bytes are run length encoded. A control byte below 0x80
+        // is followed by that many plus one literal bytes. Otherwise the
+        // next byte repeats (control&0x7F)+2 times
+        constexpr static const uint8_t flag_rle = 1;
+        uint16_t width;
+        uint16_t height;
+        uint8_t flags;
+        uint8_t rotation;
+        const uint8_t* data;
+    };
+    // a 1-bit image with a mask in the panel's page format, laid out for
+    // the given rotation. Only bits set in the mask are drawn. bits and
+    // mask are in PROGMEM unless flag_ram is set
+    struct ssd1306_masked_image {
+        constexpr static const uint8_t flag_ram = 2;
+        uint16_t width;
+        uint16_t height;
+        uint8_t flags;
+        uint8_t rotation;
+        const uint8_t* bits;
+        const uint8_t* mask;
+    };
+    // a region of a display's frame buffer saved by snapshot(). Only
+    // valid on the display that took it, and until its arena releases it
+    struct ssd1306_snapshot {
+        // the panel rectangle saved
+        gfx::rect16 rect;
+        uint8_t* data;
+        size_t size;
+    };
+    // caller provided storage for snapshots. Space is handed out in
+    // order, and released back to a given snapshot, so nested popups can
+    // each give theirs back as they close
+    class ssd1306_arena final {
+        uint8_t* m_buffer;
+        size_t m_size;
+        size_t m_used;
+    public:
+        inline ssd1306_arena(void* buffer,size_t size) : m_buffer((uint8_t*)buffer),m_size(size),m_used(0) {
+        }
+        inline size_t size() const {
+            return m_size;
+        }
+        inline size_t used() const {
+            return m_used;
+        }
+        // returns null if size bytes don't fit
+        inline uint8_t* allocate(size_t size) {
+            if(m_buffer==nullptr || size>m_size-m_used) {
+                return nullptr;
+            }
+            uint8_t* result = m_buffer+m_used;
+            m_used+=size;
+            return result;
+        }
+        // frees a snapshot and everything taken after it
+        inline void release(const ssd1306_snapshot& snapshot) {
+            if(snapshot.data>=m_buffer && snapshot.data<m_buffer+m_used) {
+                m_used = snapshot.data-m_buffer;
+            }
+        }
+        inline void clear() {
+            m_used = 0;
+        }
+    };
+    template<typename Display,size_t Slots> class ssd1306_pipeline;
+    template<typename Display,size_t Capacity> class ssd1306_shared;
+    template<typename... Displays> class ssd1306_group;
+    template<size_t Columns,size_t Rows,typename... Tiles> class ssd1306_tiled;
+    template<typename Display,size_t Capacity,uint16_t MaxSize> class ssd1306_glyph_cache;
+    template<typename Display> class ssd1306_animation;
+    template<typename Display,size_t Budget,size_t Capacity> class ssd1306_image_cache;
+    template<typename Display,size_t Capacity> class ssd1306_sprites;
+    template<uint16_t Width,uint16_t Height,typename Bus,uint8_t Address,bool Vdc3_3,uint32_t WriteSpeedPercent,int8_t PinDC,int8_t PinRst,bool ResetBeforeInit> struct ssd1306_console;
+    template<uint16_t Width,uint16_t Height,typename Bus,uint8_t Address,bool Vdc3_3,uint32_t WriteSpeedPercent,int8_t PinDC,int8_t PinRst,bool ResetBeforeInit> struct ssd1306_direct;
     template<uint16_t Width,
             uint16_t Height,
             typename Bus,
@@ -15,7 +148,7 @@ namespace arduino {
             int8_t PinRst=-1,
             bool ResetBeforeInit=false>
     struct ssd1306 final {
-        
+
         constexpr static const uint8_t rotation = Rotation &3;
         constexpr static const size_t bit_depth = BitDepth;
         constexpr static const bool dithered = bit_depth!=1;
@@ -27,340 +160,2270 @@ namespace arduino {
 private:
         constexpr static const uint16_t width=Width;
         constexpr static const uint16_t height=Height;
-        
+        // the frame buffer is stored in the panel's native page layout:
+        // one byte per column per 8 rows, LSB on top. Each bit of the
+        // pixel value gets its own plane, so 1-bit buffers are exactly
+        // what the panel's GDDRAM holds
+        constexpr static const uint16_t pages = height/8;
+        constexpr static const size_t plane_size = size_t(width)*pages;
+        // the number of overlay layers. See overlay()
+        constexpr static const size_t overlay_layers = 4;
+        static_assert((height&7)==0,"Height must be a multiple of 8");
         using bus = Bus;
         using driver = tft_driver<PinDC,PinRst,-1,Bus,-1,address,0x00,0x40>;
-        using frame_buffer_type = gfx::large_bitmap<gfx::gsc_pixel<bit_depth>>;
+        using value_type = typename gfx::gsc_pixel<bit_depth>::int_type;
         unsigned int m_initialized;
         unsigned int m_suspend_count;
         uint8_t m_contrast;
-        frame_buffer_type m_frame_buffer;
-        gfx::rect16 m_suspend_bounds;
+        uint8_t* m_frame_buffer;
+        void(*m_deallocator)(void*);
+        // dirty column span of each page. x1>x2 means clean
+        uint8_t m_dirty_x1[pages];
+        uint8_t m_dirty_x2[pages];
+        // pages flush_some() and flush_until() send first
+        bool m_priority[pages];
+        // the page an incremental flush resumes from
+        uint16_t m_flush_cursor;
+        // flush_until()'s estimate of the bus time per byte, in
+        // nanoseconds. 0 until it has timed a chunk
+        uint32_t m_byte_ns;
         bool m_dithering;
-        inline void write_bytes(const uint8_t* data,size_t size,bool is_data) {
+        // 0xFF for each pixel value lit when not dithering, else 0
+        uint8_t m_levels[1<<bit_depth];
+        ssd1306_raster_op m_raster_op;
+        struct overlay_state {
+            const ssd1306_masked_image* image;
+            gfx::spoint16 location;
+            bool visible;
+        };
+        overlay_state m_overlays[overlay_layers];
+        bool m_overlays_shown;
+        ssd1306_update_mode m_update_mode;
+        ssd1306_temporal_mode m_temporal_mode;
+        // the plane on the panel, and when it went there
+        uint8_t m_temporal_plane;
+        uint32_t m_temporal_timestamp;
+        uint32_t m_temporal_period;
+        size_t m_batch_size;
+        size_t m_batch_count;
+        uint32_t m_batch_timeout;
+        uint32_t m_batch_start;
+        enum struct async_state : uint8_t {
+            idle = 0,
+            reset_high,
+            reset_low,
+            initialize,
+            flush
+        };
+        async_state m_async_state;
+        uint32_t m_async_timestamp;
+        uint32_t m_async_id;
+        uint32_t m_async_done_id;
+        gfx::gfx_result m_async_result;
+#ifdef SSD1306_COROUTINES
+        std::coroutine_handle<> m_async_waiter;
+#endif
+        ssd1306(const ssd1306& rhs)=delete;
+        ssd1306& operator=(const ssd1306& rhs)=delete;
+        template<typename Display,size_t Slots> friend class ssd1306_pipeline;
+        template<typename Display,size_t Capacity> friend class ssd1306_shared;
+        template<typename... Displays> friend class ssd1306_group;
+        template<size_t Columns,size_t Rows,typename... Tiles> friend class ssd1306_tiled;
+        template<typename Display,size_t Capacity,uint16_t MaxSize> friend class ssd1306_glyph_cache;
+        template<typename Display> friend class ssd1306_animation;
+        template<typename Display,size_t Budget,size_t Capacity> friend class ssd1306_image_cache;
+        template<typename Display,size_t Capacity> friend class ssd1306_sprites;
+        template<uint16_t W,uint16_t H,typename B,uint8_t A,bool V,uint32_t WS,int8_t DC,int8_t RST,bool RBI> friend struct ssd1306_console;
+        template<uint16_t W,uint16_t H,typename B,uint8_t A,bool V,uint32_t WS,int8_t DC,int8_t RST,bool RBI> friend struct ssd1306_direct;
+        template<uint16_t W,uint16_t H,typename B,uint8_t R,size_t BD,uint8_t A,bool V,uint32_t WS,int8_t DC,int8_t RST,bool RBI> friend struct ssd1306;
+        inline static void write_bytes(const uint8_t* data,size_t size,bool is_data) {
             if(is_data) {
                 driver::send_data(data,size);
             } else {
                 driver::send_command(data,size);
             }
         }
-        inline void write_pgm_bytes(const uint8_t* data,size_t size,bool is_data) {
+        inline static void write_pgm_bytes(const uint8_t* data,size_t size,bool is_data) {
             if(is_data) {
                 driver::send_data_pgm(data,size);
             } else {
                 driver::send_command_pgm(data,size);
             }
         }
-        static void expand_rect(gfx::rect16& dst, const gfx::rect16& src) {
-            if(dst.x1==uint16_t(-1) || dst.y1==uint16_t(-1) || dst.x2==uint16_t(-1) || dst.y2==uint16_t(-1)) {
-                dst=src;
+        inline void mark_clean() {
+            memset(m_dirty_x1,0xFF,sizeof(m_dirty_x1));
+            memset(m_dirty_x2,0,sizeof(m_dirty_x2));
+            memset(m_priority,0,sizeof(m_priority));
+        }
+        inline void mark_dirty(uint16_t x,uint16_t page) {
+            if(x<m_dirty_x1[page]) {
+                m_dirty_x1[page]=x;
+            }
+            if(x>m_dirty_x2[page]) {
+                m_dirty_x2[page]=x;
+            }
+        }
+        // marks a normalized rectangle in panel coordinates
+        inline void mark_dirty(const gfx::rect16& rect) {
+            for(int page = rect.y1>>3;page<=(rect.y2>>3);++page) {
+                mark_dirty(rect.x1,page);
+                mark_dirty(rect.x2,page);
+            }
+        }
+        // the word types pack_levels() works in. select() takes bits from
+        // a where m is set and from b elsewhere
+        template<typename Word>
+        struct swar_lane {
+            using word = Word;
+            constexpr static const size_t size = sizeof(Word);
+            inline static word load(const uint8_t* p) {
+                word result;
+                memcpy(&result,p,sizeof(word));
+                return result;
+            }
+            inline static void store(uint8_t* p,word value) {
+                memcpy(p,&value,sizeof(word));
+            }
+            inline static word fill(uint8_t value) {
+                return value?word(~word(0)):word(0);
+            }
+            inline static word select(word m,word a,word b) {
+                return word(b^((a^b)&m));
+            }
+        };
+#ifdef SSD1306_SSE2
+        struct sse2_lane {
+            using word = __m128i;
+            constexpr static const size_t size = 16;
+            inline static word load(const uint8_t* p) {
+                return _mm_loadu_si128((const __m128i*)p);
+            }
+            inline static void store(uint8_t* p,word value) {
+                _mm_storeu_si128((__m128i*)p,value);
+            }
+            inline static word fill(uint8_t value) {
+                return _mm_set1_epi8((char)value);
+            }
+            inline static word select(word m,word a,word b) {
+                return _mm_or_si128(_mm_and_si128(m,a),_mm_andnot_si128(m,b));
+            }
+        };
+#endif
+#ifdef SSD1306_NEON
+        struct neon_lane {
+            using word = uint8x16_t;
+            constexpr static const size_t size = 16;
+            inline static word load(const uint8_t* p) {
+                return vld1q_u8(p);
+            }
+            inline static void store(uint8_t* p,word value) {
+                vst1q_u8(p,value);
+            }
+            inline static word fill(uint8_t value) {
+                return vdupq_n_u8(value);
+            }
+            inline static word select(word m,word a,word b) {
+                return vbslq_u8(m,a,b);
+            }
+        };
+#endif
+        // thresholds whole words of columns through m_levels. Since the
+        // planes are bit sliced, each plane selects between pairs of
+        // level masks for every pixel in the word at once, halving them
+        // until one is left. Returns the first column it didn't pack
+        template<typename Lane>
+        int pack_levels(const uint8_t* src,int x,int x2,uint8_t*& out) const {
+            using word = typename Lane::word;
+            constexpr static const size_t count = 1<<bit_depth;
+            word levels[count];
+            for(size_t i = 0;i<count;++i) {
+                levels[i] = Lane::fill(m_levels[i]);
+            }
+            word sel[count/2];
+            for(;x+int(Lane::size)-1<=x2;x+=Lane::size) {
+                const uint8_t* p = src+x;
+                word m = Lane::load(p);
+                size_t n = count/2;
+                for(size_t j = 0;j<n;++j) {
+                    sel[j] = Lane::select(m,levels[j*2+1],levels[j*2]);
+                }
+                for(size_t i = 1;i<bit_depth;++i) {
+                    p+=plane_size;
+                    m = Lane::load(p);
+                    n/=2;
+                    for(size_t j = 0;j<n;++j) {
+                        sel[j] = Lane::select(m,sel[j*2+1],sel[j*2]);
+                    }
+                }
+                Lane::store(out,sel[0]);
+                out+=Lane::size;
+            }
+            return x;
+        }
+        // packs a page row through the threshold table without dithering
+        void pack_threshold(const uint8_t* src,int x1,int x2,uint8_t* out) const {
+            int x = x1;
+            // past 4 bits the selects cost more than looking up each pixel
+            if(bit_depth<=4) {
+#if defined(SSD1306_SSE2)
+                x = pack_levels<sse2_lane>(src,x,x2,out);
+#elif defined(SSD1306_NEON)
+                x = pack_levels<neon_lane>(src,x,x2,out);
+#endif
+                x = pack_levels<swar_lane<size_t>>(src,x,x2,out);
+                pack_levels<swar_lane<uint8_t>>(src,x,x2,out);
                 return;
             }
-            if(src.x1<dst.x1) {
-                dst.x1 = src.x1;
+            for(;x<=x2;++x) {
+                uint8_t b = 0;
+                for(int yy = 0;yy<8;++yy) {
+                    value_type v = 0;
+                    const uint8_t* p = src+x;
+                    for(size_t i = 0;i<bit_depth;++i) {
+                        v|=((*p>>yy)&1)<<i;
+                        p+=plane_size;
+                    }
+                    b|=m_levels[v]&(1<<yy);
+                }
+                *out++=b;
             }
-            if(src.y1<dst.y1) {
-                dst.y1 = src.y1;
+        }
+        // packs one page row of the frame buffer into panel bytes, without
+        // the overlays
+        void pack_base(uint16_t page,uint16_t x1,uint16_t x2,uint8_t* out) const {
+            const uint8_t* src = m_frame_buffer+page*width;
+            if(!dithered) {
+                memcpy(out,src+x1,x2-x1+1);
+                return;
             }
-            if(src.x2>dst.x2) {
-                dst.x2 = src.x2;
+            if(!m_dithering) {
+                pack_threshold(src,x1,x2,out);
+                return;
             }
-            if(src.y2>dst.y2) {
-                dst.y2 = src.y2;
+            for(int x = x1;x<=x2;++x) {
+                uint8_t b = 0;
+                for(int yy = 0;yy<8;++yy) {
+                    const uint8_t mask = 1<<yy;
+                    value_type v = 0;
+                    const uint8_t* p = src+x;
+                    for(size_t i = 0;i<bit_depth;++i) {
+                        if(*p&mask) {
+                            v|=(1<<i);
+                        }
+                        p+=plane_size;
+                    }
+                    gfx::gsc_pixel<bit_depth> cpx;
+                    cpx.native_value = v;
+                    int col = x&15;
+                    int row = (page*8+yy)&15;
+                    b|=(1<<(yy))*(255.0*cpx.template channelr<gfx::channel_name::L>()>gfx::helpers::dither::bayer_16[col+row*16]);
+                }
+                *out++=b;
             }
         }
-
-        void update_display() {
-            if(m_suspend_count) {
+        // finds an overlay's top left corner and size in panel coordinates
+        static void overlay_native(const overlay_state& o,int* x,int* y,uint16_t* w,uint16_t* h) {
+            int x1 = o.location.x, y1 = o.location.y;
+            int x2 = x1+o.image->width-1, y2 = y1+o.image->height-1;
+            native(x1,y1);
+            native(x2,y2);
+            *x = x1<x2?x1:x2;
+            *y = y1<y2?y1:y2;
+            const bool odd = rotation&1;
+            *w = odd?o.image->height:o.image->width;
+            *h = odd?o.image->width:o.image->height;
+        }
+        // marks the part of an overlay on the panel
+        void mark_overlay(const overlay_state& o) {
+            if(!o.visible) {
                 return;
             }
-            
-            gfx::rect16 rr = m_suspend_bounds;
-            m_suspend_bounds = gfx::rect16(-1,-1,-1,-1);
-            translate(rr);
-            if(!rr.intersects(gfx::rect16(0,0,width-1,height-1))) {
+            int x, y;
+            uint16_t w, h;
+            overlay_native(o,&x,&y,&w,&h);
+            if(x+w<=0 || y+h<=0 || x>=width || y>=height) {
                 return;
             }
-            //print_source(m_frame_buffer);
-            pixel_type cpx;
-            rr.y1&=0xF8;
-            rr.y2|=0x07;
+            mark_dirty(gfx::rect16(x<0?0:x,y<0?0:y,x+w>width?width-1:x+w-1,y+h>height?height-1:y+h-1));
+        }
+        // draws the visible overlays over a packed page row, lowest first
+        void composite_overlays(uint16_t page,uint16_t x1,uint16_t x2,uint8_t* out) const {
+            const int top = page*8;
+            for(size_t i = 0;i<overlay_layers;++i) {
+                const overlay_state& o = m_overlays[i];
+                if(!o.visible) {
+                    continue;
+                }
+                int ox, oy;
+                uint16_t ow, oh;
+                overlay_native(o,&ox,&oy,&ow,&oh);
+                if(oy+oh<=top || oy>top+7) {
+                    continue;
+                }
+                const int cx1 = ox>x1?ox:x1;
+                const int cx2 = ox+ow-1<x2?ox+ow-1:x2;
+                if(cx1>cx2) {
+                    continue;
+                }
+                // the rows of this page the overlay covers
+                uint8_t rows = 0xFF;
+                if(oy>top) {
+                    rows&=uint8_t(0xFF<<(oy-top));
+                }
+                if(oy+oh-1<top+7) {
+                    rows&=uint8_t(0xFF>>(top+7-(oy+oh-1)));
+                }
+                const bool pgm = !(o.image->flags&ssd1306_masked_image::flag_ram);
+                const int spages = (oh+7)/8;
+                const int rel = top-oy;
+                const int sp = rel<0?0:rel>>3;
+                const int shift = rel<0?-rel:rel&7;
+                for(int x = cx1;x<=cx2;++x) {
+                    const int c = x-ox;
+                    uint8_t b, m;
+                    if(rel<0) {
+                        b = read_byte(o.image->bits+c,pgm)<<shift;
+                        m = read_byte(o.image->mask+c,pgm)<<shift;
+                    } else {
+                        b = read_byte(o.image->bits+sp*ow+c,pgm)>>shift;
+                        m = read_byte(o.image->mask+sp*ow+c,pgm)>>shift;
+                        if(shift && sp+1<spages) {
+                            b|=read_byte(o.image->bits+(sp+1)*ow+c,pgm)<<(8-shift);
+                            m|=read_byte(o.image->mask+(sp+1)*ow+c,pgm)<<(8-shift);
+                        }
+                    }
+                    m&=rows;
+                    uint8_t& d = out[x-x1];
+                    d = (d&~m)|(b&m);
+                }
+            }
+        }
+        // packs one page row into the bytes the panel is sent, with the
+        // overlays on top
+        inline void pack_page(uint16_t page,uint16_t x1,uint16_t x2,uint8_t* out) const {
+            pack_base(page,x1,x2,out);
+            if(m_overlays_shown) {
+                composite_overlays(page,x1,x2,out);
+            }
+        }
+        // the bytes copy_out() writes for a native rectangle
+        static inline size_t copy_size(const gfx::rect16& rect) {
+            return size_t(rect.x2-rect.x1+1)*((rect.y2>>3)-(rect.y1>>3)+1)*bit_depth;
+        }
+        // copies the pages under a native rectangle into out, one row of
+        // rect.width() bytes per page for each plane in turn, so grays
+        // are kept. Overlays are left out
+        void copy_out(const gfx::rect16& rect,uint8_t* out) const {
+            const size_t w = rect.x2-rect.x1+1;
+            for(size_t i = 0;i<bit_depth;++i) {
+                const uint8_t* src = m_frame_buffer+i*plane_size;
+                for(int page = rect.y1>>3;page<=(rect.y2>>3);++page) {
+                    memcpy(out,src+page*width+rect.x1,w);
+                    out+=w;
+                }
+            }
+        }
+        // writes pages from copy_out() back, touching only the rows inside
+        // the rectangle
+        void copy_in(const gfx::rect16& rect,const uint8_t* in) {
+            const size_t w = rect.x2-rect.x1+1;
+            const int p1 = rect.y1>>3, p2 = rect.y2>>3;
+            for(size_t i = 0;i<bit_depth;++i) {
+                for(int page = p1;page<=p2;++page) {
+                    uint8_t mask = 0xFF;
+                    if(page==p1) {
+                        mask&=uint8_t(0xFF<<(rect.y1&7));
+                    }
+                    if(page==p2) {
+                        mask&=uint8_t(0xFF>>(7-(rect.y2&7)));
+                    }
+                    uint8_t* p = m_frame_buffer+i*plane_size+page*width+rect.x1;
+                    if(mask==0xFF) {
+                        memcpy(p,in,w);
+                    } else {
+                        for(size_t x = 0;x<w;++x) {
+                            p[x] = (p[x]&~mask)|(in[x]&mask);
+                        }
+                    }
+                    in+=w;
+                }
+            }
+            mark_dirty(rect);
+        }
+        // points the panel's write address at a window of pages and columns
+        static void send_address(uint16_t p1,uint16_t x1,uint16_t x2) {
             uint8_t dlist1[] = {
                     0x22,
-                    uint8_t(rr.y1/8),                   // Page start address
+                    uint8_t(p1),                   // Page start address
                     uint8_t(0xFF),                   // Page end (not really, but works here)
-                    0x21, uint8_t(rr.x1)};// Column start address
+                    0x21, uint8_t(x1)};// Column start address
             write_bytes(dlist1, sizeof(dlist1),false);
-            uint8_t col = rr.x2;
+            uint8_t col = x2;
             write_bytes(&col,1,false); // Column end address
-            
-            if(!dithered) {   
-                for(int y = rr.y1;y<=rr.y2;y+=8) {
-                    for(int x = rr.x1;x<=rr.x2;++x) {
-                        uint8_t b = 0;
-                        for(int yy = 0;yy<8;++yy) {
-                            uint16_t tmp_x=x,tmp_y=yy+y;
-                            translate(tmp_x,tmp_y);
-                            m_frame_buffer.point({tmp_x,tmp_y},&cpx);
-                            if(cpx.native_value) {
-                                b|=(1<<(yy));
-                            }
-                        }
-                        write_bytes(&b,1,true);
-                    }
+        }
+        // sends a window of pages and columns from the frame buffer
+        void send_window(uint16_t p1,uint16_t p2,uint16_t x1,uint16_t x2) {
+            if(m_temporal_mode!=ssd1306_temporal_mode::off) {
+                // service() sends whole planes, picking up the damage
+                return;
+            }
+            send_address(p1,x1,x2);
+            uint8_t line[width];
+            for(int page = p1;page<=p2;++page) {
+                if(!dithered && !m_overlays_shown) {
+                    // 1-bit buffers are already in panel format
+                    write_bytes(m_frame_buffer+page*width+x1,x2-x1+1,true);
+                } else {
+                    pack_page(page,x1,x2,line);
+                    write_bytes(line,x2-x1+1,true);
+                }
+            }
+        }
+        // the command bytes spent addressing one window
+        constexpr static const size_t window_overhead = 6;
+        // takes a window about to be sent out of the damage. a hole in the
+        // middle of a span can't be represented, so it stays dirty
+        void trim_dirty(uint16_t p1,uint16_t p2,uint16_t x1,uint16_t x2) {
+            for(int page = p1;page<=p2;++page) {
+                uint8_t& dx1 = m_dirty_x1[page];
+                uint8_t& dx2 = m_dirty_x2[page];
+                if(dx1>dx2) {
+                    continue;
+                }
+                if(x1<=dx1 && x2>=dx2) {
+                    dx1 = 0xFF;
+                    dx2 = 0;
+                } else if(x1<=dx1 && x2>=dx1) {
+                    dx1 = x2+1;
+                } else if(x2>=dx2 && x1<=dx2) {
+                    dx2 = x1-1;
                 }
+            }
+        }
+        // sends up to max_bytes of a page's dirty span from its left edge
+        // and returns the number of bytes written including addressing
+        size_t flush_page(uint16_t page,size_t max_bytes) {
+            if(max_bytes<=window_overhead || m_dirty_x1[page]>m_dirty_x2[page]) {
+                return 0;
+            }
+            const uint16_t x1 = m_dirty_x1[page];
+            uint16_t x2 = m_dirty_x2[page];
+            if(size_t(x2-x1+1)>max_bytes-window_overhead) {
+                x2 = x1+(max_bytes-window_overhead)-1;
+            }
+            if(x2==m_dirty_x2[page]) {
+                m_dirty_x1[page]=0xFF;
+                m_dirty_x2[page]=0;
+                m_priority[page]=false;
             } else {
-                if(m_dithering) {
-                    for(int y = rr.y1;y<=rr.y2;y+=8) {
-                        for(int x = rr.x1;x<=rr.x2;++x) {
-                            int col = x&15;
-                            uint8_t b = 0;
-                            for(int yy = 0;yy<8;++yy) {
-                                int yyy = yy+y;
-                                int row=yyy&15;
-                                uint16_t tmp_x=x,tmp_y=yyy;
-                                translate(tmp_x,tmp_y);
-                                m_frame_buffer.point({tmp_x,tmp_y},&cpx);
-                                
-                                b|=(1<<(yy))*(255.0*cpx.template channelr<gfx::channel_name::L>()>gfx::helpers::dither::bayer_16[col+row*16]);
-                                
-                                
-                            }
-                            write_bytes(&b,1,true);
-                        }
+                m_dirty_x1[page]=x2+1;
+            }
+            send_window(page,page,x1,x2);
+            return x2-x1+1+window_overhead;
+        }
+        // picks the next dirty page for an incremental flush,
+        // priority pages first. returns -1 if nothing is dirty
+        int next_flush_page() const {
+            int result = -1;
+            for(int i = 0;i<pages;++i) {
+                const int page = (m_flush_cursor+i)%pages;
+                if(m_dirty_x1[page]>m_dirty_x2[page]) {
+                    continue;
+                }
+                if(m_priority[page]) {
+                    return page;
+                }
+                if(result==-1) {
+                    result = page;
+                }
+            }
+            return result;
+        }
+        void update_display() {
+            if(m_suspend_count || m_update_mode==ssd1306_update_mode::manual) {
+                return;
+            }
+            flush_dirty();
+        }
+        // splits the dirty spans into the windows that are cheapest to
+        // send, calling fn(p1,p2,x1,x2) for each. Pages are merged into one
+        // window while that costs fewer bytes than addressing them apart,
+        // so scattered damage goes out span by span and contiguous damage
+        // as a block
+        template<typename Function>
+        void dirty_windows(Function fn) const {
+            int p1 = -1, p2 = -1;
+            uint16_t x1 = 0, x2 = 0;
+            for(int page = 0;page<pages;++page) {
+                const uint16_t dx1 = m_dirty_x1[page], dx2 = m_dirty_x2[page];
+                if(dx1>dx2) {
+                    continue;
+                }
+                if(p1!=-1) {
+                    const uint16_t mx1 = dx1<x1?dx1:x1, mx2 = dx2>x2?dx2:x2;
+                    const size_t merged = size_t(page-p1+1)*(mx2-mx1+1);
+                    const size_t apart = size_t(p2-p1+1)*(x2-x1+1)+window_overhead+(dx2-dx1+1);
+                    if(merged<=apart) {
+                        p2 = page;
+                        x1 = mx1;
+                        x2 = mx2;
+                        continue;
                     }
-                } else {
-                    for(int y = rr.y1;y<=rr.y2;y+=8) {
-                        for(int x = rr.x1;x<=rr.x2;++x) {
-                            uint8_t b = 0;
-                            for(int yy = 0;yy<8;++yy) {
-                                uint16_t tmp_x=x,tmp_y=yy+y;
-                                translate(tmp_x,tmp_y);
-                                m_frame_buffer.point({tmp_x,tmp_y},&cpx);
-                                gfx::gsc_pixel<1> npx;
-                                gfx::convert(cpx,&npx);
-                                if(npx.native_value) {
-                                    b|=(1<<(yy));
-                                }
-                            }
-                            write_bytes(&b,1,true);
-                        }
-                    }   
+                    fn(uint16_t(p1),uint16_t(p2),x1,x2);
+                }
+                p1 = p2 = page;
+                x1 = dx1;
+                x2 = dx2;
+            }
+            if(p1!=-1) {
+                fn(uint16_t(p1),uint16_t(p2),x1,x2);
+            }
+        }
+        // sends the dirty spans within an already open bus session
+        void send_dirty() {
+            m_batch_count = 0;
+            dirty_windows([this](uint16_t p1,uint16_t p2,uint16_t x1,uint16_t x2) {
+                send_window(p1,p2,x1,x2);
+            });
+            mark_clean();
+        }
+        void flush_dirty() {
+            bus::begin_write();
+            send_dirty();
+            bus::end_write();
+        }
+        // sends a whole bit plane, which is already in panel format, in one
+        // burst, along with its contrast when that carries the weight
+        void send_plane(uint8_t plane) {
+            bus::begin_write();
+            send_address(0,0,width-1);
+            write_bytes(m_frame_buffer+plane*plane_size,plane_size,true);
+            uint8_t contrast = m_contrast;
+            if(m_temporal_mode==ssd1306_temporal_mode::contrast_weighted) {
+                contrast = uint8_t((uint32_t(m_contrast)<<plane)>>(bit_depth-1));
+                if(contrast==0) {
+                    contrast = 1;
                 }
             }
+            const uint8_t cmd[] = {0x81,contrast};
+            write_bytes(cmd,sizeof(cmd),false);
+            bus::end_write();
+        }
+        // sends a window of another display's frame buffer to this panel,
+        // unless this panel is cycling its own planes
+        template<typename Source>
+        void send_window_from(const Source& source,uint16_t p1,uint16_t p2,uint16_t x1,uint16_t x2) {
+            static_assert(Source::width==width && Source::height==height,"The displays must be the same size");
+            if(m_temporal_mode!=ssd1306_temporal_mode::off) {
+                return;
+            }
+            send_address(p1,x1,x2);
+            uint8_t line[width];
+            for(int page = p1;page<=p2;++page) {
+                source.pack_page(page,x1,x2,line);
+                write_bytes(line,x2-x1+1,true);
+            }
         }
-        
-        inline static void translate(uint16_t& x,uint16_t& y,bool flip=true) {
+        // maps a location from the rotated coordinate space to the panel's
+        inline static void native(uint16_t& x,uint16_t& y) {
             uint16_t tmp;
-            if(rotation&1) {
-                tmp=y;
-                y=x;
-                x=tmp;                 
-            };
+            switch(rotation) {
+                case 1:
+                    tmp=x;
+                    x=y;
+                    y=height-1-tmp;
+                    break;
+                case 2:
+                    x=width-1-x;
+                    y=height-1-y;
+                    break;
+                case 3:
+                    tmp=x;
+                    x=width-1-y;
+                    y=tmp;
+                    break;
+                default:
+                    break;
+            }
         }
-        inline static void translate(gfx::point16& point) {
-            translate(point.x,point.y);
+        inline static void native(gfx::rect16& rect) {
+            native(rect.x1,rect.y1);
+            native(rect.x2,rect.y2);
+            rect.normalize_inplace();
         }
-        inline static void translate(gfx::rect16& rect) {
-            translate(rect.x1,rect.y1,false);
-            translate(rect.x2,rect.y2,false);
-            //rect.normalize_inplace();
+        // maps a signed location, which may be off screen
+        inline static void native(int& x,int& y) {
+            int tmp;
+            switch(rotation) {
+                case 1:
+                    tmp=x;
+                    x=y;
+                    y=height-1-tmp;
+                    break;
+                case 2:
+                    x=width-1-x;
+                    y=height-1-y;
+                    break;
+                case 3:
+                    tmp=x;
+                    x=width-1-y;
+                    y=tmp;
+                    break;
+                default:
+                    break;
+            }
         }
-public:
-        ssd1306(void*(allocator)(size_t)=::malloc,void(deallocator)(void*)=::free) : 
-                    m_initialized(false),
-                    m_suspend_count(0),
-                    m_frame_buffer(dimensions(),1,nullptr,allocator,deallocator),
-                    m_suspend_bounds(-1,-1,-1,-1),
-                    m_dithering(dithered) {
-            
+        // maps a panel location back to the rotated coordinate space
+        inline static void logical(int& x,int& y) {
+            int tmp;
+            switch(rotation) {
+                case 1:
+                    tmp=x;
+                    x=height-1-y;
+                    y=tmp;
+                    break;
+                case 2:
+                    x=width-1-x;
+                    y=height-1-y;
+                    break;
+                case 3:
+                    tmp=x;
+                    x=y;
+                    y=width-1-tmp;
+                    break;
+                default:
+                    break;
+            }
         }
-        inline bool initialized() const {
-            return m_initialized;
+        inline static constexpr gfx::rect16 native_bounds() {
+            return gfx::rect16(0,0,width-1,height-1);
         }
-        void reset() {
-            if(pin_rst>=0) {
-                digitalWrite(pin_rst,HIGH);
-                delay(1);
-                digitalWrite(pin_rst,LOW);
-                delay(10);
-                digitalWrite(pin_rst,HIGH);
+        // unpacks the values of a run of pixels on a row of the rotated
+        // coordinate space, stepping through the frame buffer instead of
+        // mapping each one
+        void read_row(int x1,int x2,int y,value_type* out) const {
+            int nx = x1, ny = y;
+            native(nx,ny);
+            int sx = x1+1, sy = y;
+            native(sx,sy);
+            const int dx = sx-nx, dy = sy-ny;
+            for(int x = x1;x<=x2;++x) {
+                const uint8_t* p = m_frame_buffer+(ny>>3)*width+nx;
+                const int shift = ny&7;
+                value_type v = 0;
+                for(size_t i = 0;i<bit_depth;++i) {
+                    v|=((p[i*plane_size]>>shift)&1)<<i;
+                }
+                *out++ = v;
+                nx+=dx;
+                ny+=dy;
             }
         }
-        gfx::gfx_result initialize() {
-            if(!m_initialized) {
-                if(!m_frame_buffer.initialized()) {
-                    return gfx::gfx_result::out_of_memory;
+        // copies rows into any draw destination, a pixel at a time
+        template<typename Destination>
+        struct copy_to_helper {
+            static void copy(const ssd1306& source,const gfx::rect16& src,Destination& dst,gfx::point16 location) {
+                value_type row[width>height?width:height];
+                pixel_type px;
+                typename Destination::pixel_type dpx;
+                for(int y = src.y1;y<=src.y2;++y) {
+                    source.read_row(src.x1,src.x2,y,row);
+                    for(int x = src.x1;x<=src.x2;++x) {
+                        px.native_value = row[x-src.x1];
+                        gfx::convert(px,&dpx);
+                        dst.point(gfx::point16(location.x+x-src.x1,location.y+y-src.y1),dpx);
+                    }
                 }
-                if(!driver::initialize()) {
-                    return gfx::gfx_result::device_error;
+            }
+        };
+        // packs rows straight into a monochrome bitmap, MSB first
+        template<typename Palette>
+        struct copy_to_helper<gfx::bitmap<gfx::gsc_pixel<1>,Palette>> {
+            static void copy(const ssd1306& source,const gfx::rect16& src,gfx::bitmap<gfx::gsc_pixel<1>,Palette>& dst,gfx::point16 location) {
+                constexpr static const value_type max_value = (1<<bit_depth)-1;
+                value_type row[width>height?width:height];
+                const size_t dw = dst.dimensions().width;
+                uint8_t* const begin = dst.begin();
+                for(int y = src.y1;y<=src.y2;++y) {
+                    source.read_row(src.x1,src.x2,y,row);
+                    size_t offs = (location.y+y-src.y1)*dw+location.x;
+                    for(int x = src.x1;x<=src.x2;++x,++offs) {
+                        uint8_t& b = begin[offs>>3];
+                        const uint8_t mask = 0x80>>(offs&7);
+                        if(row[x-src.x1]*2>=max_value) {
+                            b|=mask;
+                        } else {
+                            b&=~mask;
+                        }
+                    }
                 }
-                bus::set_speed_multiplier(write_speed_multiplier);
-                if(reset_before_init) {
-                    reset();
+            }
+        };
+        // scales rows straight into an 8-bit grayscale bitmap
+        template<typename Palette>
+        struct copy_to_helper<gfx::bitmap<gfx::gsc_pixel<8>,Palette>> {
+            static void copy(const ssd1306& source,const gfx::rect16& src,gfx::bitmap<gfx::gsc_pixel<8>,Palette>& dst,gfx::point16 location) {
+                constexpr static const unsigned max_value = (1<<bit_depth)-1;
+                value_type row[width>height?width:height];
+                uint8_t levels[max_value+1];
+                for(unsigned i = 0;i<=max_value;++i) {
+                    levels[i] = uint8_t((i*255+max_value/2)/max_value);
+                }
+                const size_t dw = dst.dimensions().width;
+                for(int y = src.y1;y<=src.y2;++y) {
+                    source.read_row(src.x1,src.x2,y,row);
+                    uint8_t* p = dst.begin()+(location.y+y-src.y1)*dw+location.x;
+                    for(int x = src.x1;x<=src.x2;++x) {
+                        *p++ = levels[row[x-src.x1]];
+                    }
                 }
-                bus::begin_initialization();
-                bus::begin_write();
-                uint8_t cmd;
-                // Init sequence
-                static const uint8_t init1[] PROGMEM = {0xAE,
-                                                        0xD5,
-                                                        0x80, // the suggested ratio 0x80
-                                                        0xA8};
-                write_pgm_bytes(init1, sizeof(init1),false);
-
-                cmd=height-1;
-                write_bytes(&cmd,1,false);
-                
-                static const uint8_t init2[] PROGMEM = {0xD3,
-                                                        0x00,                      // no offset
-                                                        0x40 | 0x00, // line #0
-                                                        0x8D};
-                write_pgm_bytes(init2, sizeof(init2),false);
-                
-                cmd=!vdc_3_3 ? 0x10 : 0x14;
-                write_bytes(&cmd,1,false);
-
-                static const uint8_t init3[] PROGMEM = { 0x20,
-                                                        0x00, // 0x0 act like ks0108
-                                                        0xA0 | 0x1,
-                                                        0xC8};
-                write_pgm_bytes(init3, sizeof(init3),false);
-                uint8_t com_pins = 0x02;
-                m_contrast = 0x8F;
-                if ((width == 128) && (height == 32)) {
-                    com_pins = 0x02;
-                    m_contrast = 0x8F;
-                } else if ((width == 128) && (height == 64)) {
-                    com_pins = 0x12;
-                    m_contrast = !vdc_3_3 ? 0x9F:0xCF;
-                } else if ((width == 96) && (height == 16)) {
-                    com_pins = 0x2; // ada x12
-                    m_contrast = !vdc_3_3 ? 0x10:0xAF;
-                } else
-                    return gfx::gfx_result::invalid_argument;
-                cmd=0xDA;
-                write_bytes(&cmd,1,false);
-                write_bytes(&com_pins,1,false);
-                cmd=0x81;
-                write_bytes(&cmd,1,false);
-                write_bytes(&m_contrast,1,false);
-                cmd=0xD9;
-                write_bytes(&cmd,1,false);
-                cmd=!vdc_3_3 ? 0x22:0xF1;
-                write_bytes(&cmd,1,false);
-                static const uint8_t init5[] PROGMEM = {
-                    0xDB,
-                    0x40,
-                    0xA4,
-                    0xA6,
-                    0x2E,
-                    0xAF}; // Main screen turn on
-                write_pgm_bytes(init5, sizeof(init5),false);
-                bus::end_write();
-                bus::end_initialization();
-                m_suspend_bounds = {uint16_t(-1),uint16_t(-1),uint16_t(-1),uint16_t(-1)};
-                m_suspend_count = 0;
-                m_initialized = true;
             }
-            return gfx::gfx_result::success;
+        };
+        // combines source bits into the masked bits of a page byte per the
+        // raster op
+        inline void combine(uint8_t* p,uint8_t v,uint8_t mask) const {
+            switch(m_raster_op) {
+                case ssd1306_raster_op::bit_and:
+                    *p&=v|uint8_t(~mask);
+                    break;
+                case ssd1306_raster_op::bit_or:
+                    *p|=v&mask;
+                    break;
+                case ssd1306_raster_op::bit_xor:
+                    *p^=v&mask;
+                    break;
+                case ssd1306_raster_op::invert:
+                    *p^=mask;
+                    break;
+                default:
+                    *p = (*p&~mask)|(v&mask);
+                    break;
+            }
         }
-        inline bool dithering() const {
-            return m_dithering && dithered;
+        // sets the masked bits of a page byte in every plane
+        inline void write_native(uint8_t* p,uint8_t mask,value_type value) {
+            if(m_raster_op!=ssd1306_raster_op::copy) {
+                for(size_t i = 0;i<bit_depth;++i) {
+                    combine(p,(value&(1<<i))?0xFF:0x00,mask);
+                    p+=plane_size;
+                }
+                return;
+            }
+            for(size_t i = 0;i<bit_depth;++i) {
+                if(value&(1<<i)) {
+                    *p|=mask;
+                } else {
+                    *p&=~mask;
+                }
+                p+=plane_size;
+            }
         }
-        inline void dithering(bool value) {
-            m_dithering = value;
+        inline void write_native(uint16_t x,uint16_t y,value_type value) {
+            write_native(m_frame_buffer+(y>>3)*width+x,1<<(y&7),value);
         }
-        // GFX Bindings
-        using type = ssd1306;
-        using pixel_type = gfx::gsc_pixel<bit_depth>;
-        using caps = gfx::gfx_caps<false,false,false,false,true,true,false>;
-        constexpr inline gfx::size16 dimensions() const {return rotation&1?gfx::size16(height,width):gfx::size16(width,height);}
-        constexpr inline gfx::rect16 bounds() const { return dimensions().bounds(); }
-        // gets a point 
-        gfx::gfx_result point(gfx::point16 location,pixel_type* out_color) const {
-            if(!m_initialized) {
-                return gfx::gfx_result::invalid_state;
+        // fills a normalized rectangle in panel coordinates
+        void fill_native(const gfx::rect16& rect,value_type value) {
+            const uint16_t w = rect.x2-rect.x1+1;
+            for(int page = rect.y1>>3;page<=(rect.y2>>3);++page) {
+                uint8_t mask = 0xFF;
+                if(page==(rect.y1>>3)) {
+                    mask&=0xFF<<(rect.y1&7);
+                }
+                if(page==(rect.y2>>3)) {
+                    mask&=0xFF>>(7-(rect.y2&7));
+                }
+                uint8_t* p = m_frame_buffer+page*width+rect.x1;
+                for(size_t i = 0;i<bit_depth;++i) {
+                    const uint8_t v = (value&(1<<i))?0xFF:0x00;
+                    if(m_raster_op!=ssd1306_raster_op::copy) {
+                        for(uint16_t x = 0;x<w;++x) {
+                            combine(p+x,v,mask);
+                        }
+                    } else if(mask==0xFF) {
+                        memset(p,v,w);
+                    } else {
+                        for(uint16_t x = 0;x<w;++x) {
+                            p[x]=(p[x]&~mask)|(v&mask);
+                        }
+                    }
+                    p+=plane_size;
+                }
             }
-            if(rotation==1) {
-                location.x = m_frame_buffer.dimensions().width-1-location.x;
-            } else if(rotation==2) {
-                location.x = m_frame_buffer.dimensions().width-1-location.x;
-                location.y = m_frame_buffer.dimensions().height-1-location.y;
-            } else if(rotation==3) {
-                location.y = m_frame_buffer.dimensions().height-1-location.y;
+        }
+        inline static uint8_t read_byte(const uint8_t* p,bool pgm) {
+            return pgm?pgm_read_byte(p):*p;
+        }
+        // sets the masked bits of a page byte in every plane from a
+        // 1-bit source, using fg for set bits and bg for clear bits
+        inline void write_native(uint8_t* p,uint8_t bits,uint8_t mask,value_type fg,value_type bg) {
+            for(size_t i = 0;i<bit_depth;++i) {
+                const uint8_t v = ((fg&(1<<i))?bits:0)|((bg&(1<<i))?uint8_t(~bits):0);
+                combine(p,v,mask);
+                p+=plane_size;
             }
-            return m_frame_buffer.point(location,out_color);
-       }
-        // sets a point to the specified pixel
-        inline gfx::gfx_result point(gfx::point16 location,pixel_type color) {
-            gfx::gfx_result r = initialize();
-            if(r!=gfx::gfx_result::success) {
-                return r;
+        }
+        // draws a 1-bit page-format bitmap (a row of w bytes per 8 rows,
+        // LSB on top) at a location in panel coordinates, clipped to the
+        // panel. Set bits are drawn with fg and clear bits with bg. Only
+        // bits under the mask are touched. A null mask means the whole
+        // rectangle, or just the set bits when transparent
+        void blit_native(int x,int y,uint16_t w,uint16_t h,const uint8_t* bits,const uint8_t* mask,bool pgm,value_type fg,value_type bg,bool transparent) {
+            int sx1 = 0, sx2 = int(w)-1;
+            if(x<0) {
+                sx1 = -x;
             }
-            if(!bounds().intersects(location)) {
-                return gfx::gfx_result::success;
+            if(x+sx2>=width) {
+                sx2 = width-1-x;
             }
-            if(rotation==1) {
-                location.x = m_frame_buffer.dimensions().width-1-location.x;
-            } else if(rotation==2) {
-                location.x = m_frame_buffer.dimensions().width-1-location.x;
-                location.y = m_frame_buffer.dimensions().height-1-location.y;
-            } else if(rotation==3) {
-                location.y = m_frame_buffer.dimensions().height-1-location.y;
+            const int ry1 = y<0?0:y;
+            const int ry2 = y+int(h)-1>=height?height-1:y+int(h)-1;
+            if(sx1>sx2 || ry1>ry2) {
+                return;
             }
-            expand_rect(m_suspend_bounds,{location.x,location.y,location.x,location.y});
-            m_frame_buffer.point(location,color);
-            update_display();
-            return gfx::gfx_result::success;    
+            const int shift = y&7;
+            const int base = (y-shift)/8;
+            const int spages = (h+7)/8;
+            for(int sp = 0;sp<spages;++sp) {
+                const uint8_t row_mask = (sp==spages-1 && (h&7))?uint8_t((1<<(h&7))-1):0xFF;
+                const int q = base+sp;
+                const uint8_t* sb = bits+sp*w;
+                const uint8_t* sm = mask==nullptr?nullptr:mask+sp*w;
+                for(int c = sx1;c<=sx2;++c) {
+                    const uint8_t b = read_byte(sb+c,pgm);
+                    uint8_t m = sm!=nullptr?read_byte(sm+c,pgm):(transparent?b:0xFF);
+                    m&=row_mask;
+                    if(!m) {
+                        continue;
+                    }
+                    const uint16_t b16 = uint16_t(b)<<shift;
+                    const uint16_t m16 = uint16_t(m)<<shift;
+                    if(q>=0 && q<pages && (m16&0xFF)) {
+                        write_native(m_frame_buffer+q*width+x+c,uint8_t(b16),uint8_t(m16),fg,bg);
+                    }
+                    if(shift && q+1>=0 && q+1<pages && (m16>>8)) {
+                        write_native(m_frame_buffer+(q+1)*width+x+c,uint8_t(b16>>8),uint8_t(m16>>8),fg,bg);
+                    }
+                }
+            }
+            mark_dirty(gfx::rect16(x+sx1,ry1,x+sx2,ry2));
         }
-        inline gfx::gfx_result fill(const gfx::rect16& bounds,pixel_type color) {
-            gfx::gfx_result r = initialize();
-            if(r!=gfx::gfx_result::success) {
-                return r;
+        // reads the page bytes of an ssd1306_image in order, expanding runs
+        struct image_reader {
+            const uint8_t* p;
+            bool rle;
+            uint8_t count;
+            bool repeat;
+            uint8_t value;
+            image_reader(const ssd1306_image& img) : p(img.data),rle(img.flags&ssd1306_image::flag_rle),count(0),repeat(false),value(0) {
             }
-            gfx::rect16 rect = bounds.crop(this->bounds()).normalize();
-            if(!this->bounds().intersects(rect)) {
-                return gfx::gfx_result::success;
+            inline uint8_t next() {
+                if(!rle) {
+                    return pgm_read_byte(p++);
+                }
+                if(!count) {
+                    const uint8_t c = pgm_read_byte(p++);
+                    repeat = c&0x80;
+                    count = repeat?(c&0x7F)+2:c+1;
+                    if(repeat) {
+                        value = pgm_read_byte(p++);
+                    }
+                }
+                --count;
+                return repeat?value:pgm_read_byte(p++);
+            }
+        };
+        // draws an ssd1306_image whose top left corner is at a location in
+        // the rotated coordinate space
+        void image_impl(const ssd1306_image& img,int x,int y,value_type fg,value_type bg,bool transparent) {
+            const bool odd = img.rotation&1;
+            const uint16_t iw = odd?img.height:img.width;
+            const uint16_t ih = odd?img.width:img.height;
+            const int ipages = (ih+7)/8;
+            image_reader reader(img);
+            if(img.rotation==rotation) {
+                // same layout as the frame buffer, so copy pages
+                int x1 = x, y1 = y, x2 = x+img.width-1, y2 = y+img.height-1;
+                native(x1,y1);
+                native(x2,y2);
+                const int nx = x1<x2?x1:x2;
+                const int ny = y1<y2?y1:y2;
+                if(!(img.flags&ssd1306_image::flag_rle)) {
+                    blit_native(nx,ny,iw,ih,img.data,nullptr,true,fg,bg,transparent);
+                    return;
+                }
+                uint8_t line[width];
+                for(int ip = 0;ip<ipages;++ip) {
+                    const uint16_t h = ip==ipages-1 && (ih&7)?(ih&7):8;
+                    for(int c = 0;c<iw;c+=width) {
+                        const uint16_t w = iw-c<width?iw-c:width;
+                        for(int i = 0;i<w;++i) {
+                            line[i]=reader.next();
+                        }
+                        blit_native(nx+c,ny+ip*8,w,h,line,nullptr,false,fg,bg,transparent);
+                    }
+                }
+                return;
+            }
+            // different layout. map each pixel back through the image's
+            // rotation, then forward through ours
+            for(int ip = 0;ip<ipages;++ip) {
+                for(int ix = 0;ix<iw;++ix) {
+                    const uint8_t b = reader.next();
+                    for(int bit = 0;bit<8 && ip*8+bit<ih;++bit) {
+                        const bool set = b&(1<<bit);
+                        if(!set && transparent) {
+                            continue;
+                        }
+                        const int iy = ip*8+bit;
+                        int lx, ly;
+                        switch(img.rotation) {
+                            case 1:
+                                lx = ih-1-iy; ly = ix;
+                                break;
+                            case 2:
+                                lx = iw-1-ix; ly = ih-1-iy;
+                                break;
+                            case 3:
+                                lx = iy; ly = iw-1-ix;
+                                break;
+                            default:
+                                lx = ix; ly = iy;
+                                break;
+                        }
+                        lx+=x;
+                        ly+=y;
+                        if(lx<0 || ly<0 || lx>=dimensions().width || ly>=dimensions().height) {
+                            continue;
+                        }
+                        native(lx,ly);
+                        write_native(uint16_t(lx),uint16_t(ly),set?fg:bg);
+                    }
+                }
+            }
+            gfx::srect16 sr(x,y,x+img.width-1,y+img.height-1);
+            if(((gfx::srect16)bounds()).intersects(sr)) {
+                gfx::rect16 dirty = (gfx::rect16)sr.crop((gfx::srect16)bounds());
+                native(dirty);
+                mark_dirty(dirty);
             }
-            if(rotation==1) {
-                rect.x1 = m_frame_buffer.dimensions().width-1-rect.x1;
-                rect.x2 = m_frame_buffer.dimensions().width-1-rect.x2;
-                rect.normalize_inplace();
-            } else if(rotation==2) {
-                rect.x1 = m_frame_buffer.dimensions().width-1-rect.x1;
-                rect.x2 = m_frame_buffer.dimensions().width-1-rect.x2;
-                rect.y1 = m_frame_buffer.dimensions().height-1-rect.y1;
-                rect.y2 = m_frame_buffer.dimensions().height-1-rect.y2;
-                rect.normalize_inplace();
-            } else if(rotation==3) {
-                rect.y1 = m_frame_buffer.dimensions().height-1-rect.y1;
-                rect.y2 = m_frame_buffer.dimensions().height-1-rect.y2;
-                rect.normalize_inplace();
-            }
-            expand_rect(m_suspend_bounds,rect);
-            m_frame_buffer.fill(rect,color);
-            update_display();
-            return gfx::gfx_result::success;
         }
-        
-        // clears the specified rectangle
-        inline gfx::gfx_result clear(const gfx::rect16& rect) {
-            pixel_type p;
-            return fill(rect,p);
+        // moves a normalized panel rectangle by dx,dy in every plane. The
+        // destination must be on the panel. Page aligned vertical moves of
+        // whole pages are memmoves. Anything else shifts each column as a
+        // 64-bit word
+        void move_native(const gfx::rect16& src,int dx,int dy) {
+            static_assert(height<=64,"Columns must fit in 64 bits");
+            const uint16_t w = src.x2-src.x1+1;
+            if(!(dy&7) && !(src.y1&7) && (src.y2&7)==7) {
+                const int p1 = src.y1>>3, p2 = src.y2>>3, dp = dy/8;
+                for(size_t i = 0;i<bit_depth;++i) {
+                    uint8_t* plane = m_frame_buffer+i*plane_size;
+                    for(int n = 0;n<=p2-p1;++n) {
+                        const int page = dp>0?p2-n:p1+n;
+                        memmove(plane+(page+dp)*width+src.x1+dx,plane+page*width+src.x1,w);
+                    }
+                }
+                return;
+            }
+            const uint64_t mask = (uint64_t(-1)>>(63-(src.y2-src.y1)))<<src.y1;
+            const uint64_t dmask = dy<0?mask>>-dy:mask<<dy;
+            for(size_t i = 0;i<bit_depth;++i) {
+                uint8_t* plane = m_frame_buffer+i*plane_size;
+                for(uint16_t n = 0;n<w;++n) {
+                    // walk against the direction of travel so sources are
+                    // read before they're overwritten
+                    const int x = dx>0?src.x2-n:src.x1+n;
+                    uint64_t s = 0, d = 0;
+                    for(int page = 0;page<pages;++page) {
+                        s|=uint64_t(plane[page*width+x])<<(page*8);
+                        d|=uint64_t(plane[page*width+x+dx])<<(page*8);
+                    }
+                    s&=mask;
+                    s = dy<0?s>>-dy:s<<dy;
+                    d = (d&~dmask)|s;
+                    for(int page = 0;page<pages;++page) {
+                        plane[page*width+x+dx] = uint8_t(d>>(page*8));
+                    }
+                }
+            }
         }
-        inline gfx::gfx_result suspend() {
-            ++m_suspend_count;
-            return gfx::gfx_result::success;
+        // clips a line to the rectangle. returns false if nothing is left
+        static bool clip_line(int& x1,int& y1,int& x2,int& y2,const gfx::rect16& clip) {
+            const int l = clip.x1, t = clip.y1, r = clip.x2, b = clip.y2;
+            auto code = [l,t,r,b](int x,int y) {
+                return (x<l?1:0)|(x>r?2:0)|(y<t?4:0)|(y>b?8:0);
+            };
+            int c1 = code(x1,y1), c2 = code(x2,y2);
+            while(true) {
+                if(!(c1|c2)) {
+                    return true;
+                }
+                if(c1&c2) {
+                    return false;
+                }
+                const int c = c1?c1:c2;
+                int32_t x,y;
+                const int32_t dx = x2-x1, dy = y2-y1;
+                if(c&8) {
+                    x = x1+dx*(b-y1)/dy; y = b;
+                } else if(c&4) {
+                    x = x1+dx*(t-y1)/dy; y = t;
+                } else if(c&2) {
+                    y = y1+dy*(r-x1)/dx; x = r;
+                } else {
+                    y = y1+dy*(l-x1)/dx; x = l;
+                }
+                if(c==c1) {
+                    x1=x;y1=y;c1=code(x1,y1);
+                } else {
+                    x2=x;y2=y;c2=code(x2,y2);
+                }
+            }
         }
-        gfx::gfx_result resume(bool force=false) {
-            if(m_suspend_count<2 || force) {
-                m_suspend_count = 0;
-                update_display();
-                return gfx::gfx_result::success;
+        // steps a clipped line through the frame buffer in panel coordinates
+        // also marks the columns it crosses on each page, so a diagonal
+        // line doesn't send its whole bounding box
+        void line_native(int x1,int y1,int x2,int y2,value_type value) {
+            const int dx = x2>x1?x2-x1:x1-x2;
+            const int dy = y2>y1?y1-y2:y2-y1;
+            const int sx = x1<x2?1:-1;
+            const int sy = y1<y2?1:-1;
+            int err = dx+dy;
+            int page = y1>>3;
+            uint8_t* p = m_frame_buffer+page*width+x1;
+            uint8_t mask = 1<<(y1&7);
+            mark_dirty(x1,page);
+            while(true) {
+                write_native(p,mask,value);
+                if(x1==x2 && y1==y2) {
+                    break;
+                }
+                const int plotted = x1;
+                const int e2 = err*2;
+                if(e2>=dy) {
+                    err+=dy;
+                    x1+=sx;
+                    p+=sx;
+                }
+                if(e2<=dx) {
+                    err+=dx;
+                    y1+=sy;
+                    if(sy>0) {
+                        mask<<=1;
+                        if(!mask) {
+                            mask=0x01;
+                            p+=width;
+                            mark_dirty(plotted,page++);
+                            mark_dirty(x1,page);
+                        }
+                    } else {
+                        mask>>=1;
+                        if(!mask) {
+                            mask=0x80;
+                            p-=width;
+                            mark_dirty(plotted,page--);
+                            mark_dirty(x1,page);
+                        }
+                    }
+                }
             }
-            --m_suspend_count;
-            return gfx::gfx_result::success;
+            mark_dirty(x2,page);
         }
+        inline void ellipse_point(int x,int y,value_type value) {
+            if(x<0||y<0||x>=dimensions().width||y>=dimensions().height) {
+                return;
+            }
+            uint16_t ux = x,uy=y;
+            native(ux,uy);
+            write_native(ux,uy,value);
+        }
+        inline void ellipse_span(int x1,int x2,int y,value_type value) {
+            if(y<0 || y>=dimensions().height) {
+                return;
+            }
+            if(x1<0) {
+                x1=0;
+            }
+            if(x2>=dimensions().width) {
+                x2=dimensions().width-1;
+            }
+            if(x1>x2) {
+                return;
+            }
+            gfx::rect16 r(x1,y,x2,y);
+            native(r);
+            fill_native(r,value);
+        }
+        // integer ellipse inscribed in a rectangle (after A. Zingl)
+        void ellipse_impl(const gfx::srect16& bounds,value_type value,bool filled) {
+            const gfx::srect16 rect = bounds.normalize();
+            int x0 = rect.x1, y0 = rect.y1, x1 = rect.x2, y1 = rect.y2;
+            int64_t a = x1-x0, b = y1-y0, b1 = b&1;
+            int64_t dx = 4*(1-a)*b*b, dy = 4*(b1+1)*a*a;
+            int64_t err = dx+dy+b1*a*a, e2;
+            y0+=(b+1)/2;
+            y1=y0-b1;
+            a*=8*a;
+            b1=8*b*b;
+            do {
+                if(filled) {
+                    ellipse_span(x0,x1,y0,value);
+                    ellipse_span(x0,x1,y1,value);
+                } else {
+                    ellipse_point(x1,y0,value);
+                    ellipse_point(x0,y0,value);
+                    ellipse_point(x0,y1,value);
+                    ellipse_point(x1,y1,value);
+                }
+                e2 = 2*err;
+                if(e2<=dy) {
+                    ++y0;
+                    --y1;
+                    err+=dy+=a;
+                }
+                if(e2>=dx || 2*err>dy) {
+                    ++x0;
+                    --x1;
+                    err+=dx+=b1;
+                }
+            } while(x0<=x1);
+            while(y0-y1<b) {
+                if(filled) {
+                    ellipse_span(x0-1,x1+1,y0,value);
+                    ellipse_span(x0-1,x1+1,y1,value);
+                } else {
+                    ellipse_point(x0-1,y0,value);
+                    ellipse_point(x1+1,y0,value);
+                    ellipse_point(x0-1,y1,value);
+                    ellipse_point(x1+1,y1,value);
+                }
+                ++y0;
+                --y1;
+            }
+        }
+        gfx::gfx_result begin_initialization() {
+            if(m_frame_buffer==nullptr) {
+                return gfx::gfx_result::out_of_memory;
+            }
+            if(!driver::initialize()) {
+                return gfx::gfx_result::device_error;
+            }
+            bus::set_speed_multiplier(write_speed_multiplier);
+            return gfx::gfx_result::success;
+        }
+        // sends the init sequence once the panel is out of reset
+        gfx::gfx_result send_initialization() {
+            gfx::gfx_result r = send_init_sequence(m_contrast);
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            mark_clean();
+            m_suspend_count = 0;
+            m_batch_count = 0;
+            m_initialized = true;
+            return gfx::gfx_result::success;
+        }
+        // sends the panel's init commands. Used by drivers without a frame buffer, too
+        static gfx::gfx_result send_init_sequence(uint8_t& out_contrast) {
+            bus::begin_initialization();
+            bus::begin_write();
+            uint8_t cmd;
+            // Init sequence
+            static const uint8_t init1[] PROGMEM = {0xAE,
+                                                    0xD5,
+                                                    0x80, // the suggested ratio 0x80
+                                                    0xA8};
+            write_pgm_bytes(init1, sizeof(init1),false);
+
+            cmd=height-1;
+            write_bytes(&cmd,1,false);
+
+            static const uint8_t init2[] PROGMEM = {0xD3,
+                                                    0x00,                      // no offset
+                                                    0x40 | 0x00, // line #0
+                                                    0x8D};
+            write_pgm_bytes(init2, sizeof(init2),false);
+
+            cmd=!vdc_3_3 ? 0x10 : 0x14;
+            write_bytes(&cmd,1,false);
+
+            static const uint8_t init3[] PROGMEM = { 0x20,
+                                                    0x00, // 0x0 act like ks0108
+                                                    0xA0 | 0x1,
+                                                    0xC8};
+            write_pgm_bytes(init3, sizeof(init3),false);
+            uint8_t com_pins = 0x02;
+            out_contrast = 0x8F;
+            if ((width == 128) && (height == 32)) {
+                com_pins = 0x02;
+                out_contrast = 0x8F;
+            } else if ((width == 128) && (height == 64)) {
+                com_pins = 0x12;
+                out_contrast = !vdc_3_3 ? 0x9F:0xCF;
+            } else if ((width == 96) && (height == 16)) {
+                com_pins = 0x2; // ada x12
+                out_contrast = !vdc_3_3 ? 0x10:0xAF;
+            } else
+                return gfx::gfx_result::invalid_argument;
+            cmd=0xDA;
+            write_bytes(&cmd,1,false);
+            write_bytes(&com_pins,1,false);
+            cmd=0x81;
+            write_bytes(&cmd,1,false);
+            write_bytes(&out_contrast,1,false);
+            cmd=0xD9;
+            write_bytes(&cmd,1,false);
+            cmd=!vdc_3_3 ? 0x22:0xF1;
+            write_bytes(&cmd,1,false);
+            static const uint8_t init5[] PROGMEM = {
+                0xDB,
+                0x40,
+                0xA4,
+                0xA6,
+                0x2E,
+                0xAF}; // Main screen turn on
+            write_pgm_bytes(init5, sizeof(init5),false);
+            bus::end_write();
+            bus::end_initialization();
+            return gfx::gfx_result::success;
+        }
+        void complete_async(gfx::gfx_result result) {
+            m_async_state = async_state::idle;
+            m_async_result = result;
+            m_async_done_id = m_async_id;
+#ifdef SSD1306_COROUTINES
+            if(m_async_waiter) {
+                std::coroutine_handle<> waiter = m_async_waiter;
+                m_async_waiter = nullptr;
+                waiter.resume();
+            }
+#endif
+        }
+public:
+        // a handle to an asynchronous operation. Call poll() (on the
+        // future or the display) until done(). The result stays valid
+        // until the next asynchronous operation starts. With C++20
+        // coroutines it can be co_awaited, and is resumed by whoever
+        // polls the display
+        class future final {
+            friend struct ssd1306;
+            ssd1306* m_display;
+            uint32_t m_id;
+            gfx::gfx_result m_result;
+            inline future(gfx::gfx_result result) : m_display(nullptr),m_id(0),m_result(result) {
+            }
+            inline future(ssd1306* display,uint32_t id) : m_display(display),m_id(id),m_result(gfx::gfx_result::success) {
+            }
+        public:
+            inline bool done() const {
+                return m_display==nullptr || int32_t(m_display->m_async_done_id-m_id)>=0;
+            }
+            inline bool poll() {
+                if(!done()) {
+                    m_display->poll();
+                }
+                return done();
+            }
+            inline gfx::gfx_result result() const {
+                return m_display==nullptr?m_result:m_display->m_async_result;
+            }
+            // polls until the operation completes
+            gfx::gfx_result wait() {
+                while(!poll());
+                return result();
+            }
+#ifdef SSD1306_COROUTINES
+            inline bool await_ready() {
+                return poll();
+            }
+            inline void await_suspend(std::coroutine_handle<> waiter) {
+                m_display->m_async_waiter = waiter;
+            }
+            inline gfx::gfx_result await_resume() const {
+                return result();
+            }
+#endif
+        };
+        ssd1306(void*(allocator)(size_t)=::malloc,void(deallocator)(void*)=::free) :
+                    m_initialized(false),
+                    m_suspend_count(0),
+                    m_frame_buffer((uint8_t*)allocator(plane_size*bit_depth)),
+                    m_deallocator(deallocator),
+                    m_flush_cursor(0),
+                    m_byte_ns(0),
+                    m_dithering(dithered),
+                    m_raster_op(ssd1306_raster_op::copy),
+                    m_overlays_shown(false),
+                    m_update_mode(ssd1306_update_mode::immediate),
+                    m_temporal_mode(ssd1306_temporal_mode::off),
+                    m_temporal_plane(0),
+                    m_temporal_timestamp(0),
+                    m_temporal_period(2000),
+                    m_batch_size(64),
+                    m_batch_count(0),
+                    m_batch_timeout(16),
+                    m_batch_start(0),
+                    m_async_state(async_state::idle),
+                    m_async_timestamp(0),
+                    m_async_id(0),
+                    m_async_done_id(0),
+                    m_async_result(gfx::gfx_result::success) {
+            if(m_frame_buffer!=nullptr) {
+                memset(m_frame_buffer,0,plane_size*bit_depth);
+            }
+            for(size_t i = 0;i<overlay_layers;++i) {
+                m_overlays[i].image = nullptr;
+                m_overlays[i].visible = false;
+            }
+            // match gfx's conversion to monochrome by default
+            for(size_t i = 0;i<(1<<bit_depth);++i) {
+                gfx::gsc_pixel<bit_depth> cpx;
+                cpx.native_value = value_type(i);
+                gfx::gsc_pixel<1> npx;
+                gfx::convert(cpx,&npx);
+                m_levels[i] = npx.native_value?0xFF:0;
+            }
+            mark_clean();
+        }
+        ~ssd1306() {
+            if(m_frame_buffer!=nullptr) {
+                m_deallocator(m_frame_buffer);
+                m_frame_buffer = nullptr;
+            }
+        }
+        inline bool initialized() const {
+            return m_initialized;
+        }
+        void reset() {
+            if(pin_rst>=0) {
+                digitalWrite(pin_rst,HIGH);
+                delay(1);
+                digitalWrite(pin_rst,LOW);
+                delay(10);
+                digitalWrite(pin_rst,HIGH);
+            }
+        }
+        // fails with gfx_result::invalid_state while initialize_async() is
+        // still running, rather than starting the panel over
+        gfx::gfx_result initialize() {
+            if(!m_initialized) {
+                if(m_async_state!=async_state::idle) {
+                    return gfx::gfx_result::invalid_state;
+                }
+                gfx::gfx_result r = begin_initialization();
+                if(r!=gfx::gfx_result::success) {
+                    return r;
+                }
+                if(reset_before_init) {
+                    reset();
+                }
+                return send_initialization();
+            }
+            return gfx::gfx_result::success;
+        }
+        // starts initializing the display without blocking. The reset
+        // delays are timed with millis() instead of delay()
+        future initialize_async() {
+            if(m_async_state!=async_state::idle) {
+                return future(gfx::gfx_result::invalid_state);
+            }
+            if(m_initialized) {
+                return future(gfx::gfx_result::success);
+            }
+            gfx::gfx_result r = begin_initialization();
+            if(r!=gfx::gfx_result::success) {
+                return future(r);
+            }
+            if(reset_before_init && pin_rst>=0) {
+                digitalWrite(pin_rst,HIGH);
+                m_async_timestamp = millis();
+                m_async_state = async_state::reset_high;
+            } else {
+                m_async_state = async_state::initialize;
+            }
+            return future(this,++m_async_id);
+        }
+        // starts sending all pending damage without blocking. Each poll()
+        // sends one page span
+        future flush_async() {
+            if(m_async_state!=async_state::idle) {
+                return future(gfx::gfx_result::invalid_state);
+            }
+            if(!m_initialized) {
+                return future(gfx::gfx_result::invalid_state);
+            }
+            m_async_state = async_state::flush;
+            return future(this,++m_async_id);
+        }
+        // advances the pending asynchronous operation by one step.
+        // returns true while an operation is still in progress
+        bool poll() {
+            switch(m_async_state) {
+                case async_state::reset_high:
+                    if(millis()-m_async_timestamp>=1) {
+                        digitalWrite(pin_rst,LOW);
+                        m_async_timestamp = millis();
+                        m_async_state = async_state::reset_low;
+                    }
+                    return true;
+                case async_state::reset_low:
+                    if(millis()-m_async_timestamp>=10) {
+                        digitalWrite(pin_rst,HIGH);
+                        m_async_state = async_state::initialize;
+                    }
+                    return true;
+                case async_state::initialize:
+                    complete_async(send_initialization());
+                    // a resumed waiter may have started another operation
+                    return m_async_state!=async_state::idle;
+                case async_state::flush:
+                    flush_some(width+window_overhead);
+                    if(!dirty()) {
+                        complete_async(gfx::gfx_result::success);
+                        return m_async_state!=async_state::idle;
+                    }
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        // whether grays are dithered: when packing gray buffers, and when
+        // image_sink decodes into 1-bit buffers. Off by default for 1-bit
+        inline bool dithering() const {
+            return m_dithering;
+        }
+        inline void dithering(bool value) {
+            m_dithering = value;
+        }
+        // the table deciding which pixel values are lit when not dithering,
+        // one entry per value. Build it from a gamma curve and threshold to
+        // control how grays come out. Nonzero entries are lit
+        inline const uint8_t* threshold_table() const {
+            return m_levels;
+        }
+        void threshold_table(const uint8_t* table) {
+            for(size_t i = 0;i<(1<<bit_depth);++i) {
+                m_levels[i] = table[i]?0xFF:0;
+            }
+        }
+        // lights pixel values at or above level when not dithering
+        void threshold(value_type level) {
+            for(size_t i = 0;i<(1<<bit_depth);++i) {
+                m_levels[i] = i>=level?0xFF:0;
+            }
+        }
+        // moves the contents of a rectangle so its top left corner is at
+        // destination, in the frame buffer. Only the destination is
+        // marked for sending. If out_vacated isn't null, it receives the
+        // part of the source the move left behind for you to redraw. For
+        // diagonal moves that's the whole source. When nothing was left
+        // behind its x2 is less than its x1
+        gfx::gfx_result move(const gfx::srect16& source,gfx::spoint16 destination,gfx::srect16* out_vacated=nullptr) {
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            const gfx::srect16 sb = (gfx::srect16)bounds();
+            const gfx::srect16 sn = source.normalize();
+            const int ddx = destination.x-sn.x1, ddy = destination.y-sn.y1;
+            gfx::srect16 vacated(0,0,-1,-1);
+            if(sb.intersects(sn)) {
+                const gfx::srect16 src = sn.crop(sb);
+                vacated = src;
+                if(ddy==0 && ddx>0 && src.x1+ddx-1<src.x2) {
+                    vacated.x2 = src.x1+ddx-1;
+                } else if(ddy==0 && ddx<0 && src.x2+ddx+1>src.x1) {
+                    vacated.x1 = src.x2+ddx+1;
+                } else if(ddx==0 && ddy>0 && src.y1+ddy-1<src.y2) {
+                    vacated.y2 = src.y1+ddy-1;
+                } else if(ddx==0 && ddy<0 && src.y2+ddy+1>src.y1) {
+                    vacated.y1 = src.y2+ddy+1;
+                } else if(ddx==0 && ddy==0) {
+                    vacated = gfx::srect16(0,0,-1,-1);
+                }
+                const gfx::srect16 dst = src.offset(ddx,ddy);
+                if((ddx || ddy) && sb.intersects(dst)) {
+                    const gfx::srect16 cdst = dst.crop(sb);
+                    gfx::rect16 ns = (gfx::rect16)cdst.offset(-ddx,-ddy);
+                    gfx::rect16 nd = (gfx::rect16)cdst;
+                    native(ns);
+                    native(nd);
+                    move_native(ns,int(nd.x1)-ns.x1,int(nd.y1)-ns.y1);
+                    mark_dirty(nd);
+                    update_display();
+                }
+            }
+            if(out_vacated!=nullptr) {
+                *out_vacated = vacated;
+            }
+            return gfx::gfx_result::success;
+        }
+        // the arena bytes a snapshot of rect needs
+        size_t snapshot_size(const gfx::srect16& rect) const {
+            const gfx::srect16 sb = (gfx::srect16)bounds();
+            const gfx::srect16 sn = rect.normalize();
+            if(!sb.intersects(sn)) {
+                return 0;
+            }
+            gfx::rect16 r = (gfx::rect16)sn.crop(sb);
+            native(r);
+            return copy_size(r);
+        }
+        // saves the frame buffer under rect, such as before opening a
+        // popup, into storage from arena. The pages are copied as is,
+        // overlays aside, so this costs a memcpy per page and plane
+        gfx::gfx_result snapshot(const gfx::srect16& rect,ssd1306_arena& arena,ssd1306_snapshot* out_snapshot) {
+            if(out_snapshot==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            out_snapshot->data = nullptr;
+            out_snapshot->size = 0;
+            if(m_frame_buffer==nullptr) {
+                return gfx::gfx_result::out_of_memory;
+            }
+            const gfx::srect16 sb = (gfx::srect16)bounds();
+            const gfx::srect16 sn = rect.normalize();
+            if(!sb.intersects(sn)) {
+                out_snapshot->rect = gfx::rect16(0,0,0,0);
+                return gfx::gfx_result::success;
+            }
+            gfx::rect16 r = (gfx::rect16)sn.crop(sb);
+            native(r);
+            const size_t size = copy_size(r);
+            uint8_t* out = arena.allocate(size);
+            if(out==nullptr) {
+                return gfx::gfx_result::out_of_memory;
+            }
+            out_snapshot->rect = r;
+            out_snapshot->data = out;
+            out_snapshot->size = size;
+            copy_out(r,out);
+            return gfx::gfx_result::success;
+        }
+        // puts back what snapshot() saved, touching only the rows inside
+        // its rectangle, and sends it once. Release the snapshot from its
+        // arena afterward
+        gfx::gfx_result restore(const ssd1306_snapshot& snapshot) {
+            if(snapshot.data==nullptr) {
+                return snapshot.size==0?gfx::gfx_result::success:gfx::gfx_result::invalid_argument;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            copy_in(snapshot.rect,snapshot.data);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        // shows a masked image on an overlay layer, over the frame buffer.
+        // Overlays are combined with the frame buffer as it's sent, so
+        // showing, moving or hiding one never changes what's drawn under
+        // it and only sends its footprint. Higher layers are drawn over
+        // lower ones. A null image hides the layer. The image must be laid
+        // out for this rotation and stay valid while shown
+        gfx::gfx_result overlay(size_t layer,const ssd1306_masked_image* image,gfx::spoint16 location) {
+            if(layer>=overlay_layers) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(image!=nullptr && (image->bits==nullptr || image->mask==nullptr)) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(image!=nullptr && image->rotation!=rotation) {
+                return gfx::gfx_result::invalid_format;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            overlay_state& o = m_overlays[layer];
+            mark_overlay(o);
+            o.image = image;
+            o.location = location;
+            o.visible = image!=nullptr;
+            mark_overlay(o);
+            m_overlays_shown = false;
+            for(size_t i = 0;i<overlay_layers;++i) {
+                m_overlays_shown|=m_overlays[i].visible;
+            }
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        // moves an overlay
+        inline gfx::gfx_result overlay(size_t layer,gfx::spoint16 location) {
+            if(layer>=overlay_layers) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            return overlay(layer,m_overlays[layer].image,location);
+        }
+        // the image shown on an overlay layer, or null
+        inline const ssd1306_masked_image* overlay(size_t layer) const {
+            return layer<overlay_layers?m_overlays[layer].image:nullptr;
+        }
+        // how drawing combines with the frame buffer. Applies to point(),
+        // fill(), lines, ellipses, images and text drawn by the driver, so
+        // GFX draw calls pick it up too
+        inline ssd1306_raster_op raster_op() const {
+            return m_raster_op;
+        }
+        inline void raster_op(ssd1306_raster_op value) {
+            m_raster_op = value;
+        }
+        inline ssd1306_update_mode update_mode() const {
+            return m_update_mode;
+        }
+        inline void update_mode(ssd1306_update_mode value) {
+            m_update_mode = value;
+        }
+        inline ssd1306_temporal_mode temporal_mode() const {
+            return m_temporal_mode;
+        }
+        // starts or stops showing gray levels by cycling the bit planes.
+        // While on, call service() as often as you can. Overlays aren't
+        // shown. Turning it off sends the whole screen the normal way
+        gfx::gfx_result temporal_mode(ssd1306_temporal_mode value) {
+            if(value!=ssd1306_temporal_mode::off && bit_depth==1) {
+                return gfx::gfx_result::not_supported;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            m_temporal_mode = value;
+            if(value==ssd1306_temporal_mode::off) {
+                bus::begin_write();
+                const uint8_t cmd[] = {0x81,m_contrast};
+                write_bytes(cmd,sizeof(cmd),false);
+                bus::end_write();
+                mark_dirty(native_bounds());
+                update_display();
+                return gfx::gfx_result::success;
+            }
+            mark_clean();
+            m_temporal_plane = 0;
+            m_temporal_timestamp = micros();
+            send_plane(0);
+            return gfx::gfx_result::success;
+        }
+        // the microseconds the lowest plane is shown for. The planes
+        // together take bit_depth periods when contrast weighted, or
+        // 2^bit_depth-1 when time weighted. Shorter flickers less, but each
+        // period must fit a whole plane on the bus
+        inline uint32_t temporal_period() const {
+            return m_temporal_period;
+        }
+        inline void temporal_period(uint32_t value) {
+            m_temporal_period = value;
+        }
+        // sends batched points once batch_timeout() has passed, and in
+        // temporal mode puts the next plane on the panel once the current
+        // one has been shown long enough. Call this from your loop.
+        // Falling behind skips ahead rather than rushing to catch up
+        gfx::gfx_result service() {
+            if(m_temporal_mode==ssd1306_temporal_mode::off) {
+                if(m_batch_count && millis()-m_batch_start>=m_batch_timeout) {
+                    update_display();
+                }
+                return gfx::gfx_result::success;
+            }
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            uint32_t due = m_temporal_period;
+            if(m_temporal_mode==ssd1306_temporal_mode::time_weighted) {
+                due<<=m_temporal_plane;
+            }
+            const uint32_t elapsed = micros()-m_temporal_timestamp;
+            if(elapsed<due) {
+                return gfx::gfx_result::success;
+            }
+            // keep to the schedule unless we're a whole period late
+            m_temporal_timestamp = elapsed-due<m_temporal_period?m_temporal_timestamp+due:m_temporal_timestamp+elapsed;
+            m_temporal_plane = (m_temporal_plane+1)%bit_depth;
+            m_batch_count = 0;
+            mark_clean();
+            send_plane(m_temporal_plane);
+            return gfx::gfx_result::success;
+        }
+        // the number of consecutive unsuspended point() writes
+        // coalesced into one flush. 0 or 1 flushes every point
+        inline size_t batch_size() const {
+            return m_batch_size;
+        }
+        inline void batch_size(size_t value) {
+            m_batch_size = value;
+        }
+        // the longest a batched point may wait, in milliseconds, before
+        // the next point() or service() flushes it. Any other drawing
+        // call, resume() or flush() sends pending points immediately.
+        // Without any of those, trailing points stay pending
+        inline uint32_t batch_timeout() const {
+            return m_batch_timeout;
+        }
+        inline void batch_timeout(uint32_t value) {
+            m_batch_timeout = value;
+        }
+        // GFX Bindings
+        using type = ssd1306;
+        using pixel_type = gfx::gsc_pixel<bit_depth>;
+        using caps = gfx::gfx_caps<false,false,false,false,true,true,true>;
+        constexpr inline gfx::size16 dimensions() const {return rotation&1?gfx::size16(height,width):gfx::size16(width,height);}
+        constexpr inline gfx::rect16 bounds() const { return dimensions().bounds(); }
+        // gets a point
+        gfx::gfx_result point(gfx::point16 location,pixel_type* out_color) const {
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            if(out_color==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(!bounds().intersects(location)) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            native(location.x,location.y);
+            const uint8_t* p = m_frame_buffer+(location.y>>3)*width+location.x;
+            const uint8_t mask = 1<<(location.y&7);
+            value_type v = 0;
+            for(size_t i = 0;i<bit_depth;++i) {
+                if(*p&mask) {
+                    v|=(1<<i);
+                }
+                p+=plane_size;
+            }
+            out_color->native_value = v;
+            return gfx::gfx_result::success;
+       }
+        // copies a rectangle into another draw destination, such as a
+        // bitmap for a screenshot. Rows are unpacked in bulk, and written
+        // directly into gsc_pixel<1> and gsc_pixel<8> bitmaps
+        template<typename Destination>
+        gfx::gfx_result copy_to(const gfx::rect16& src_rect,Destination& dst,gfx::point16 location) const {
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            if(!src_rect.intersects(bounds())) {
+                return gfx::gfx_result::success;
+            }
+            gfx::rect16 src = src_rect.crop(bounds());
+            const gfx::rect16 db = dst.bounds();
+            if(location.x>db.x2 || location.y>db.y2) {
+                return gfx::gfx_result::success;
+            }
+            // keep what fits in the destination
+            if(src.x2-src.x1>db.x2-location.x) {
+                src.x2 = src.x1+(db.x2-location.x);
+            }
+            if(src.y2-src.y1>db.y2-location.y) {
+                src.y2 = src.y1+(db.y2-location.y);
+            }
+            copy_to_helper<Destination>::copy(*this,src,dst,location);
+            return gfx::gfx_result::success;
+        }
+        // sets a point to the specified pixel
+        inline gfx::gfx_result point(gfx::point16 location,pixel_type color) {
+            if(!m_initialized) {
+                gfx::gfx_result r = initialize();
+                if(r!=gfx::gfx_result::success) {
+                    return r;
+                }
+            }
+            if(location.x>=dimensions().width || location.y>=dimensions().height) {
+                return gfx::gfx_result::success;
+            }
+            native(location.x,location.y);
+            const uint16_t page = location.y>>3;
+            mark_dirty(location.x,page);
+            write_native(m_frame_buffer+page*width+location.x,1<<(location.y&7),color.native_value);
+            if(m_update_mode==ssd1306_update_mode::immediate) {
+                update_display();
+            } else if(!m_suspend_count && m_update_mode==ssd1306_update_mode::coalesced) {
+                if(m_batch_count==0) {
+                    m_batch_start = millis();
+                }
+                if(++m_batch_count>=m_batch_size || millis()-m_batch_start>=m_batch_timeout) {
+                    update_display();
+                }
+            }
+            return gfx::gfx_result::success;
+        }
+        inline gfx::gfx_result fill(const gfx::rect16& bounds,pixel_type color) {
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            gfx::rect16 rect = bounds.crop(this->bounds()).normalize();
+            if(!this->bounds().intersects(rect)) {
+                return gfx::gfx_result::success;
+            }
+            native(rect);
+            mark_dirty(rect);
+            fill_native(rect,color.native_value);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+
+        // clears the specified rectangle
+        inline gfx::gfx_result clear(const gfx::rect16& rect) {
+            pixel_type p;
+            return fill(rect,p);
+        }
+        // draws a line from (x1,y1) to (x2,y2) directly into the frame
+        // buffer. gfx::draw::line() can't reach this and plots diagonal
+        // lines with point(), so call it on the display for speed
+        gfx::gfx_result line(const gfx::srect16& endpoints,pixel_type color) {
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            int x1 = endpoints.x1, y1 = endpoints.y1, x2 = endpoints.x2, y2 = endpoints.y2;
+            if(!clip_line(x1,y1,x2,y2,bounds())) {
+                return gfx::gfx_result::success;
+            }
+            uint16_t ux1 = x1, uy1 = y1, ux2 = x2, uy2 = y2;
+            native(ux1,uy1);
+            native(ux2,uy2);
+            line_native(ux1,uy1,ux2,uy2,color.native_value);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        // draws an ellipse inscribed in the rectangle. use a square for a
+        // circle. Like line(), it's only faster called directly
+        gfx::gfx_result ellipse(const gfx::srect16& rect,pixel_type color) {
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            gfx::srect16 sr = rect.normalize().crop((gfx::srect16)bounds());
+            if(!((gfx::srect16)bounds()).intersects(rect.normalize())) {
+                return gfx::gfx_result::success;
+            }
+            gfx::rect16 dirty = (gfx::rect16)sr;
+            native(dirty);
+            mark_dirty(dirty);
+            ellipse_impl(rect,color.native_value,false);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        // draws a filled ellipse inscribed in the rectangle
+        gfx::gfx_result filled_ellipse(const gfx::srect16& rect,pixel_type color) {
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            gfx::srect16 sr = rect.normalize().crop((gfx::srect16)bounds());
+            if(!((gfx::srect16)bounds()).intersects(rect.normalize())) {
+                return gfx::gfx_result::success;
+            }
+            gfx::rect16 dirty = (gfx::rect16)sr;
+            native(dirty);
+            mark_dirty(dirty);
+            ellipse_impl(rect,color.native_value,true);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        // draws a page-format image with set bits in white and clear bits
+        // in black, or leaves clear bits alone when transparent. When the
+        // image was converted for this rotation its pages are copied
+        // straight from PROGMEM
+        inline gfx::gfx_result image(const ssd1306_image& img,gfx::spoint16 location,bool transparent=false) {
+            pixel_type white;
+            white.native_value = value_type((1<<bit_depth)-1);
+            return image(img,location,white,pixel_type(),transparent);
+        }
+        gfx::gfx_result image(const ssd1306_image& img,gfx::spoint16 location,pixel_type color,pixel_type backcolor,bool transparent=false) {
+            if(img.data==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            image_impl(img,location.x,location.y,color.native_value,backcolor.native_value,transparent);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        // the bytes each of the bits and mask of a masked image of the
+        // given dimensions take
+        constexpr inline static size_t masked_image_size(gfx::size16 dimensions) {
+            return (rotation&1)?size_t(dimensions.height)*((dimensions.width+7)/8):size_t(dimensions.width)*((dimensions.height+7)/8);
+        }
+        // builds a masked image laid out for this display from a bitmap or
+        // other readable source, once, so it can be drawn without checking
+        // the transparent color each time. Pixels of the transparent
+        // color are masked out and the rest are thresholded to white or
+        // black. bits and mask must each hold masked_image_size() bytes
+        template<typename Source>
+        static gfx::gfx_result make_masked_image(const Source& source,typename Source::pixel_type transparent,uint8_t* bits,uint8_t* mask,ssd1306_masked_image* out_image) {
+            if(bits==nullptr || mask==nullptr || out_image==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            const gfx::size16 dim = source.dimensions();
+            const size_t size = masked_image_size(dim);
+            memset(bits,0,size);
+            memset(mask,0,size);
+            const uint16_t nw = (rotation&1)?dim.height:dim.width;
+            // the native corner the image's pages start from
+            int ox = 0, oy = 0, ex = dim.width-1, ey = dim.height-1;
+            native(ox,oy);
+            native(ex,ey);
+            ox = ox<ex?ox:ex;
+            oy = oy<ey?oy:ey;
+            for(int y = 0;y<dim.height;++y) {
+                for(int x = 0;x<dim.width;++x) {
+                    typename Source::pixel_type px;
+                    gfx::gfx_result r = source.point(gfx::point16(x,y),&px);
+                    if(r!=gfx::gfx_result::success) {
+                        return r;
+                    }
+                    if(px.native_value==transparent.native_value) {
+                        continue;
+                    }
+                    int nx = x, ny = y;
+                    native(nx,ny);
+                    nx-=ox;
+                    ny-=oy;
+                    const size_t i = (ny>>3)*nw+nx;
+                    const uint8_t bit = 1<<(ny&7);
+                    mask[i]|=bit;
+                    gfx::gsc_pixel<1> mpx;
+                    r = gfx::convert(px,&mpx);
+                    if(r!=gfx::gfx_result::success) {
+                        return r;
+                    }
+                    if(mpx.native_value) {
+                        bits[i]|=bit;
+                    }
+                }
+            }
+            out_image->width = dim.width;
+            out_image->height = dim.height;
+            out_image->flags = ssd1306_masked_image::flag_ram;
+            out_image->rotation = rotation;
+            out_image->bits = bits;
+            out_image->mask = mask;
+            return gfx::gfx_result::success;
+        }
+        // draws a masked image, replacing only the pixels under its mask.
+        // Each page byte is written as (dst&~mask)|(src&mask) at any y
+        // offset. The image must be laid out for this rotation
+        inline gfx::gfx_result image(const ssd1306_masked_image& img,gfx::spoint16 location) {
+            pixel_type white;
+            white.native_value = value_type((1<<bit_depth)-1);
+            return image(img,location,white,pixel_type());
+        }
+        gfx::gfx_result image(const ssd1306_masked_image& img,gfx::spoint16 location,pixel_type color,pixel_type backcolor) {
+            if(img.bits==nullptr || img.mask==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(img.rotation!=rotation) {
+                return gfx::gfx_result::invalid_format;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            int x1 = location.x, y1 = location.y;
+            int x2 = x1+img.width-1, y2 = y1+img.height-1;
+            native(x1,y1);
+            native(x2,y2);
+            const bool odd = rotation&1;
+            blit_native(x1<x2?x1:x2,y1<y2?y1:y2,
+                        odd?img.height:img.width,
+                        odd?img.width:img.height,
+                        img.bits,img.mask,!(img.flags&ssd1306_masked_image::flag_ram),
+                        color.native_value,backcolor.native_value,false);
+            update_display();
+            return gfx::gfx_result::success;
+        }
+        inline gfx::gfx_result suspend() {
+            ++m_suspend_count;
+            return gfx::gfx_result::success;
+        }
+        gfx::gfx_result resume(bool force=false) {
+            if(m_suspend_count<2 || force) {
+                m_suspend_count = 0;
+                update_display();
+                return gfx::gfx_result::success;
+            }
+            --m_suspend_count;
+            return gfx::gfx_result::success;
+        }
+        // sends all pending damage now, regardless of the update mode
+        // or any outstanding suspend()
+        gfx::gfx_result flush() {
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            flush_dirty();
+            return gfx::gfx_result::success;
+        }
+        // sends the specified region now, regardless of the update mode
+        // or any outstanding suspend()
+        gfx::gfx_result flush(const gfx::rect16& bounds) {
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            gfx::rect16 rect = bounds.crop(this->bounds()).normalize();
+            if(!this->bounds().intersects(rect)) {
+                return gfx::gfx_result::success;
+            }
+            native(rect);
+            const uint16_t p1 = rect.y1>>3, p2 = rect.y2>>3;
+            trim_dirty(p1,p2,rect.x1,rect.x2);
+            bus::begin_write();
+            send_window(p1,p2,rect.x1,rect.x2);
+            bus::end_write();
+            return gfx::gfx_result::success;
+        }
+        // sends at most byte_budget bytes of pending damage, including
+        // addressing commands. Pages marked with prioritize() go first.
+        // sending resumes where it left off on the next call
+        gfx::gfx_result flush_some(size_t byte_budget,size_t* out_bytes_sent=nullptr) {
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            size_t sent = 0;
+            bus::begin_write();
+            while(true) {
+                const int page = next_flush_page();
+                if(page==-1) {
+                    break;
+                }
+                const size_t n = flush_page(page,byte_budget-sent);
+                if(n==0) {
+                    break;
+                }
+                sent+=n;
+                m_flush_cursor = page;
+            }
+            bus::end_write();
+            m_batch_count = 0;
+            if(out_bytes_sent!=nullptr) {
+                *out_bytes_sent = sent;
+            }
+            return gfx::gfx_result::success;
+        }
+        // sends pending damage in chunks of up to chunk_size columns,
+        // shrinking the last one to what is expected to finish by
+        // deadline_us. Pages marked with prioritize() go first. The bus
+        // time per byte is measured on every chunk, and the first chunk the
+        // display ever sends this way is what measures it, so only that one
+        // can overrun the deadline freely. After that it returns late by no
+        // more than the last chunk ran slower than the estimate, which on a
+        // steady bus is just the time spent in interrupts
+        gfx::gfx_result flush_until(uint32_t deadline_us,size_t chunk_size = 32) {
+            if(!m_initialized) {
+                return gfx::gfx_result::invalid_state;
+            }
+            bus::begin_write();
+            while(true) {
+                const int page = next_flush_page();
+                if(page==-1) {
+                    break;
+                }
+                const uint32_t start = micros();
+                const int32_t remaining = int32_t(deadline_us-start);
+                if(remaining<=0) {
+                    break;
+                }
+                size_t bytes = m_dirty_x2[page]-m_dirty_x1[page]+1;
+                if(bytes>chunk_size) {
+                    bytes = chunk_size;
+                }
+                bytes+=window_overhead;
+                if(m_byte_ns!=0) {
+                    const uint64_t fits = uint64_t(remaining)*1000/m_byte_ns;
+                    if(fits<=window_overhead) {
+                        // an estimate inflated by an interrupt could stop
+                        // every call from sending, so let it creep down
+                        // until a chunk is timed again
+                        m_byte_ns-=(m_byte_ns+7)/8;
+                        break;
+                    }
+                    if(bytes>fits) {
+                        bytes = size_t(fits);
+                    }
+                }
+                bytes = flush_page(page,bytes);
+                m_flush_cursor = page;
+                // interrupts only make a chunk look slower, so follow a
+                // faster measurement at once and a slower one gradually
+                uint32_t measured = uint32_t(uint64_t(micros()-start)*1000/bytes);
+                if(measured==0) {
+                    measured = 1;
+                }
+                if(m_byte_ns==0 || measured<m_byte_ns) {
+                    m_byte_ns = measured;
+                } else {
+                    m_byte_ns+=(measured-m_byte_ns)/4;
+                }
+            }
+            bus::end_write();
+            m_batch_count = 0;
+            return gfx::gfx_result::success;
+        }
+        // indicates whether there is damage that hasn't been sent
+        bool dirty() const {
+            for(int page = 0;page<pages;++page) {
+                if(m_dirty_x1[page]<=m_dirty_x2[page]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // marks the pages under the region to be sent first by
+        // flush_some() and flush_until() until they are clean
+        gfx::gfx_result prioritize(const gfx::rect16& bounds) {
+            gfx::rect16 rect = bounds.crop(this->bounds()).normalize();
+            if(!this->bounds().intersects(rect)) {
+                return gfx::gfx_result::success;
+            }
+            native(rect);
+            for(int page = rect.y1>>3;page<=(rect.y2>>3);++page) {
+                m_priority[page]=true;
+            }
+            return gfx::gfx_result::success;
+        }
+        // receives decoded image blocks, such as from gfx::jpeg_image::load()
+        // with image_sink::callback, and writes only their visible part
+        // straight into the frame buffer's pages. Blocks outside the
+        // display are skipped, and once blocks pass the bottom of the
+        // visible area the decode is canceled. Damage is marked once, by
+        // finish()
+        class image_sink final {
+            ssd1306& m_display;
+            gfx::srect16 m_destination;
+            gfx::srect16 m_clip;
+            gfx::rect16 m_damage;
+            bool m_visible;
+            bool m_any;
+            image_sink(const image_sink& rhs)=delete;
+            image_sink& operator=(const image_sink& rhs)=delete;
+            template<typename Region>
+            void write_visible(const Region& block,const gfx::srect16& area,const gfx::srect16& visible) {
+                gfx::rect16 rect = (gfx::rect16)visible;
+                native(rect);
+                // gray buffers keep the grays and are dithered when packed
+                const bool dither = bit_depth==1 && m_display.dithering();
+                for(int page = rect.y1>>3;page<=(rect.y2>>3);++page) {
+                    const int y1 = page*8<rect.y1?rect.y1:page*8;
+                    const int y2 = page*8+7>rect.y2?rect.y2:page*8+7;
+                    uint8_t mask = 0;
+                    for(int y = y1;y<=y2;++y) {
+                        mask|=(1<<(y&7));
+                    }
+                    uint8_t* p = m_display.m_frame_buffer+page*width+rect.x1;
+                    for(int x = rect.x1;x<=rect.x2;++x,++p) {
+                        uint8_t bits[bit_depth];
+                        memset(bits,0,sizeof(bits));
+                        for(int y = y1;y<=y2;++y) {
+                            int lx = x, ly = y;
+                            logical(lx,ly);
+                            typename Region::pixel_type spx;
+                            block.point(gfx::point16(lx-area.x1,ly-area.y1),&spx);
+                            const uint8_t bit = 1<<(y&7);
+                            if(dither) {
+                                gfx::gsc_pixel<8> g;
+                                gfx::convert(spx,&g);
+                                if(g.native_value>gfx::helpers::dither::bayer_16[(x&15)+(y&15)*16]) {
+                                    bits[0]|=bit;
+                                }
+                                continue;
+                            }
+                            pixel_type px;
+                            gfx::convert(spx,&px);
+                            for(size_t i = 0;i<bit_depth;++i) {
+                                if(px.native_value&(1<<i)) {
+                                    bits[i]|=bit;
+                                }
+                            }
+                        }
+                        uint8_t* pp = p;
+                        for(size_t i = 0;i<bit_depth;++i) {
+                            *pp = (*pp&~mask)|(bits[i]&mask);
+                            pp+=plane_size;
+                        }
+                    }
+                }
+                if(!m_any) {
+                    m_damage = rect;
+                    m_any = true;
+                    return;
+                }
+                if(rect.x1<m_damage.x1) {
+                    m_damage.x1 = rect.x1;
+                }
+                if(rect.y1<m_damage.y1) {
+                    m_damage.y1 = rect.y1;
+                }
+                if(rect.x2>m_damage.x2) {
+                    m_damage.x2 = rect.x2;
+                }
+                if(rect.y2>m_damage.y2) {
+                    m_damage.y2 = rect.y2;
+                }
+            }
+        public:
+            // draws an image with its top left corner at the destination's,
+            // cropped to the destination
+            image_sink(ssd1306& display,const gfx::srect16& destination) :
+                                m_display(display),
+                                m_destination(destination.normalize()),
+                                m_any(false) {
+                const gfx::srect16 sb = (gfx::srect16)display.bounds();
+                m_visible = display.initialize()==gfx::gfx_result::success && sb.intersects(m_destination);
+                m_clip = m_destination.crop(sb);
+            }
+            // writes a decoded block at a location in the image. Returns
+            // canceled once the rest of the image can't be visible
+            template<typename Region>
+            gfx::gfx_result write(const Region& block,gfx::point16 location) {
+                if(!m_visible) {
+                    return gfx::gfx_result::canceled;
+                }
+                const gfx::size16 dim = block.dimensions();
+                const gfx::srect16 area(m_destination.x1+location.x,
+                                        m_destination.y1+location.y,
+                                        m_destination.x1+location.x+dim.width-1,
+                                        m_destination.y1+location.y+dim.height-1);
+                if(area.y1>m_clip.y2) {
+                    return gfx::gfx_result::canceled;
+                }
+                if(!m_clip.intersects(area)) {
+                    return gfx::gfx_result::success;
+                }
+                write_visible(block,area,area.crop(m_clip));
+                return gfx::gfx_result::success;
+            }
+            // marks the damage and sends it, per the update mode
+            gfx::gfx_result finish() {
+                if(m_any) {
+                    m_display.mark_dirty(m_damage);
+                    m_any = false;
+                }
+                m_display.update_display();
+                return gfx::gfx_result::success;
+            }
+            // an image decoder callback. Pass the sink as the state
+            template<typename Region>
+            static gfx::gfx_result callback(gfx::size16 dimensions,Region& block,gfx::point16 location,void* state) {
+                (void)dimensions;
+                return ((image_sink*)state)->write(block,location);
+            }
+        };
+        // suspends the display for its lifetime, replacing paired
+        // suspend() and resume() calls
+        class transaction final {
+            ssd1306& m_display;
+            transaction(const transaction& rhs)=delete;
+            transaction& operator=(const transaction& rhs)=delete;
+        public:
+            inline transaction(ssd1306& display) : m_display(display) {
+                m_display.suspend();
+            }
+            inline ~transaction() {
+                m_display.resume();
+            }
+        };
     };
-}
\ No newline at end of file
+}
+#endif // HTCW_SSD1306_HPP
@@ -0,0 +1,289 @@
+#ifndef HTCW_SSD1306_ANIMATION_HPP
+#define HTCW_SSD1306_ANIMATION_HPP
+#include <io_stream.hpp>
+#include <ssd1306.hpp>
+namespace arduino {
+    // plays animations stored as XOR deltas between 1-bit frames in the
+    // panel's page format. Each delta is applied straight to the frame
+    // buffer, and each page it touched is sent from its first to its last
+    // changed column, so small changes cost a few bytes on the wire.
+    // Looping resends the whole area along with the first frame, since it
+    // is blanked again. Use tools/ssd1306_convert -a to
+    // produce them. The stream layout is little endian:
+    //   'S','A'                        magic
+    //   uint16 width, uint16 height    in the rotated coordinate space
+    //   uint8 rotation                 the rotation the pages are laid out for
+    //   uint16 frames
+    //   uint16 delay                   milliseconds between frames
+    // then for each frame, runs of
+    //   uint8 page, uint8 column, uint8 length, length XOR bytes
+    // terminated by a page of 0xFF. The first frame is a delta against a
+    // blank frame
+    template<typename Display>
+    class ssd1306_animation final {
+    public:
+        using display_type = Display;
+        constexpr static const size_t header_size = 11;
+    private:
+        display_type& m_display;
+        const uint8_t* m_data;
+        size_t m_offset;
+        io::stream* m_stream;
+        unsigned long long m_stream_start;
+        uint16_t m_width;
+        uint16_t m_height;
+        uint16_t m_frames;
+        uint16_t m_delay;
+        uint16_t m_frame;
+        gfx::srect16 m_bounds;
+        int m_x;
+        int m_y;
+        bool m_loop;
+        bool m_started;
+        uint32_t m_timestamp;
+        ssd1306_animation(const ssd1306_animation& rhs)=delete;
+        ssd1306_animation& operator=(const ssd1306_animation& rhs)=delete;
+        inline int read() {
+            if(m_stream!=nullptr) {
+                return m_stream->getch();
+            }
+            return pgm_read_byte(m_data+m_offset++);
+        }
+        bool read(uint8_t* out,size_t size) {
+            if(m_stream!=nullptr) {
+                return size==m_stream->read(out,size);
+            }
+            for(size_t i = 0;i<size;++i) {
+                out[i]=pgm_read_byte(m_data+m_offset++);
+            }
+            return true;
+        }
+        inline bool read16(uint16_t* out) {
+            uint8_t b[2];
+            if(!read(b,2)) {
+                return false;
+            }
+            *out = b[0]|(uint16_t(b[1])<<8);
+            return true;
+        }
+        // blanks the animation's area, since the first frame is a delta
+        // against nothing
+        void clear_area() {
+            const gfx::srect16 sb = (gfx::srect16)m_display.bounds();
+            if(!sb.intersects(m_bounds)) {
+                return;
+            }
+            gfx::rect16 rect = (gfx::rect16)m_bounds.crop(sb);
+            display_type::native(rect);
+            m_display.mark_dirty(rect);
+            m_display.fill_native(rect,0);
+        }
+        // seeks to the first frame
+        gfx::gfx_result rewind() {
+            if(m_stream!=nullptr) {
+                if(!m_stream->caps().seek) {
+                    return gfx::gfx_result::not_supported;
+                }
+                m_stream->seek(m_stream_start+header_size);
+            } else {
+                m_offset = header_size;
+            }
+            m_frame = 0;
+            clear_area();
+            return gfx::gfx_result::success;
+        }
+        // applies one run of XOR bytes to every plane, shifted into the
+        // panel's pages and clipped to the panel
+        void xor_run(int page,int column,const uint8_t* bytes,size_t length) {
+            const int shift = m_y&7;
+            const int q = (m_y-shift)/8+page;
+            int x1 = m_x+column, x2 = x1+int(length)-1;
+            const int sx = x1;
+            if(x1<0) {
+                x1 = 0;
+            }
+            if(x2>=display_type::width) {
+                x2 = display_type::width-1;
+            }
+            if(x1>x2) {
+                return;
+            }
+            const bool lo = q>=0 && q<display_type::pages;
+            const bool hi = shift && q+1>=0 && q+1<display_type::pages;
+            uint8_t* p = m_display.m_frame_buffer+x1;
+            for(int x = x1;x<=x2;++x,++p) {
+                const uint8_t b = bytes[x-sx];
+                for(size_t i = 0;i<display_type::bit_depth;++i) {
+                    uint8_t* pp = p+i*display_type::plane_size;
+                    if(lo) {
+                        pp[q*display_type::width]^=uint8_t(b<<shift);
+                    }
+                    if(hi) {
+                        pp[(q+1)*display_type::width]^=uint8_t(b>>(8-shift));
+                    }
+                }
+            }
+            if(lo) {
+                m_display.mark_dirty(x1,q);
+                m_display.mark_dirty(x2,q);
+            }
+            if(hi) {
+                m_display.mark_dirty(x1,q+1);
+                m_display.mark_dirty(x2,q+1);
+            }
+        }
+    public:
+        // plays from a buffer in PROGMEM
+        ssd1306_animation(display_type& display,const uint8_t* data) :
+                                m_display(display),
+                                m_data(data),
+                                m_offset(0),
+                                m_stream(nullptr),
+                                m_stream_start(0),
+                                m_width(0),
+                                m_height(0),
+                                m_frames(0),
+                                m_delay(0),
+                                m_frame(0),
+                                m_x(0),
+                                m_y(0),
+                                m_loop(false),
+                                m_started(false),
+                                m_timestamp(0) {
+        }
+        // plays from a stream, starting at its current position. Looping
+        // requires a seekable stream
+        ssd1306_animation(display_type& display,io::stream* stream) :
+                                m_display(display),
+                                m_data(nullptr),
+                                m_offset(0),
+                                m_stream(stream),
+                                m_stream_start(0),
+                                m_width(0),
+                                m_height(0),
+                                m_frames(0),
+                                m_delay(0),
+                                m_frame(0),
+                                m_x(0),
+                                m_y(0),
+                                m_loop(false),
+                                m_started(false),
+                                m_timestamp(0) {
+        }
+        inline gfx::size16 dimensions() const {
+            return gfx::size16(m_width,m_height);
+        }
+        inline uint16_t frames() const {
+            return m_frames;
+        }
+        // the index of the next frame to be shown
+        inline uint16_t frame() const {
+            return m_frame;
+        }
+        // the milliseconds between frames
+        inline uint16_t delay() const {
+            return m_delay;
+        }
+        inline bool loop() const {
+            return m_loop;
+        }
+        inline void loop(bool value) {
+            m_loop = value;
+        }
+        inline bool done() const {
+            return m_started && !m_loop && m_frame>=m_frames;
+        }
+        // reads the header and blanks the area at location the animation
+        // will play in, sending it unless the display is suspended or in
+        // manual mode
+        gfx::gfx_result begin(gfx::spoint16 location) {
+            if(m_data==nullptr && m_stream==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            gfx::gfx_result r = m_display.initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            if(m_stream!=nullptr) {
+                m_stream_start = m_stream->seek(0,io::seek_origin::current);
+            } else {
+                m_offset = 0;
+            }
+            uint8_t magic[2];
+            if(!read(magic,2)) {
+                return gfx::gfx_result::io_error;
+            }
+            if(magic[0]!='S' || magic[1]!='A') {
+                return gfx::gfx_result::invalid_format;
+            }
+            int rotation;
+            if(!read16(&m_width) || !read16(&m_height) || (rotation = read())<0 || !read16(&m_frames) || !read16(&m_delay)) {
+                return gfx::gfx_result::io_error;
+            }
+            // the deltas are copied into the frame buffer as is
+            if(rotation!=display_type::rotation) {
+                return gfx::gfx_result::invalid_format;
+            }
+            m_bounds = gfx::srect16(location.x,location.y,location.x+m_width-1,location.y+m_height-1);
+            int x1 = m_bounds.x1, y1 = m_bounds.y1, x2 = m_bounds.x2, y2 = m_bounds.y2;
+            display_type::native(x1,y1);
+            display_type::native(x2,y2);
+            m_x = x1<x2?x1:x2;
+            m_y = y1<y2?y1:y2;
+            m_frame = 0;
+            m_started = true;
+            m_timestamp = millis();
+            clear_area();
+            m_display.update_display();
+            return gfx::gfx_result::success;
+        }
+        // applies the next frame's delta and sends the columns it touched
+        // on each page
+        gfx::gfx_result next_frame() {
+            if(!m_started) {
+                return gfx::gfx_result::invalid_state;
+            }
+            if(m_frame>=m_frames) {
+                if(!m_loop) {
+                    return gfx::gfx_result::success;
+                }
+                gfx::gfx_result r = rewind();
+                if(r!=gfx::gfx_result::success) {
+                    return r;
+                }
+            }
+            uint8_t run[255];
+            while(true) {
+                const int page = read();
+                if(page<0) {
+                    return gfx::gfx_result::io_error;
+                }
+                if(page==0xFF) {
+                    break;
+                }
+                const int column = read();
+                const int length = read();
+                if(column<0 || length<0 || !read(run,length)) {
+                    return gfx::gfx_result::io_error;
+                }
+                xor_run(page,column,run,length);
+            }
+            ++m_frame;
+            m_display.update_display();
+            return gfx::gfx_result::success;
+        }
+        // shows the next frame once delay() has elapsed. Call this
+        // regularly
+        gfx::gfx_result update() {
+            if(!m_started) {
+                return gfx::gfx_result::invalid_state;
+            }
+            if(done() || millis()-m_timestamp<m_delay) {
+                return gfx::gfx_result::success;
+            }
+            m_timestamp = millis();
+            return next_frame();
+        }
+    };
+}
+#endif // HTCW_SSD1306_ANIMATION_HPP
@@ -0,0 +1,290 @@
+#ifndef HTCW_SSD1306_CONSOLE_HPP
+#define HTCW_SSD1306_CONSOLE_HPP
+#include <ssd1306.hpp>
+#include <gfx_font.hpp>
+namespace arduino {
+    // a character cell text mode driver for the SSD1306 with no frame
+    // buffer. It stores one byte per 8x8 cell plus one attribute byte,
+    // and expands glyphs from an 8x8 PROGMEM font straight into the
+    // outgoing page data when dirty cells are flushed, so changing a
+    // character costs 8 bytes on the wire. Scrolling uses the panel's
+    // display start line register instead of resending the screen
+    template<uint16_t Width,
+            uint16_t Height,
+            typename Bus,
+            uint8_t Address = 0x3C,
+            bool Vdc3_3=true,
+            uint32_t WriteSpeedPercent=400,
+            int8_t PinDC=-1,
+            int8_t PinRst=-1,
+            bool ResetBeforeInit=false>
+    struct ssd1306_console final {
+        constexpr static const uint16_t columns = Width/8;
+        constexpr static const uint16_t rows = Height/8;
+        // cell attributes
+        constexpr static const uint8_t attribute_inverse = 1;
+        constexpr static const uint8_t attribute_blink = 2;
+private:
+        using panel = ssd1306<Width,Height,Bus,0,1,Address,Vdc3_3,WriteSpeedPercent,PinDC,PinRst,ResetBeforeInit>;
+        using bus = Bus;
+        constexpr static const size_t cell_count = size_t(columns)*rows;
+        constexpr static const bool hardware_scroll = Height==64;
+        bool m_initialized;
+        const gfx::font& m_font;
+        uint8_t m_contrast;
+        uint8_t m_cells[cell_count];
+        uint8_t m_attributes[cell_count];
+        uint8_t m_dirty[(cell_count+7)/8];
+        // the panel page the first text row is stored on
+        uint16_t m_top;
+        uint16_t m_column;
+        uint16_t m_row;
+        uint8_t m_attribute;
+        bool m_blink_phase;
+        uint32_t m_blink_interval;
+        uint32_t m_blink_timestamp;
+        ssd1306_console(const ssd1306_console& rhs)=delete;
+        ssd1306_console& operator=(const ssd1306_console& rhs)=delete;
+        inline size_t index(uint16_t column,uint16_t row) const {
+            return size_t(row)*columns+column;
+        }
+        inline void mark_dirty(size_t i) {
+            m_dirty[i>>3]|=(1<<(i&7));
+        }
+        inline bool is_dirty(size_t i) const {
+            return m_dirty[i>>3]&(1<<(i&7));
+        }
+        inline void mark_row_dirty(uint16_t row) {
+            for(uint16_t c = 0;c<columns;++c) {
+                mark_dirty(index(c,row));
+            }
+        }
+        // transposes an 8x8 glyph into page-format column bytes
+        void expand(size_t i,uint8_t* out) const {
+            const gfx::font_char fc = m_font.find_char((char)m_cells[i]);
+            const uint8_t* data = fc.data();
+            uint8_t rows_data[8];
+            for(int y = 0;y<8;++y) {
+                rows_data[y] = y<m_font.height()?pgm_read_byte(data+y):0;
+            }
+            for(int x = 0;x<8;++x) {
+                const uint8_t bit = 0x80>>x;
+                uint8_t b = 0;
+                for(int y = 0;y<8;++y) {
+                    if(rows_data[y]&bit) {
+                        b|=(1<<y);
+                    }
+                }
+                out[x]=b;
+            }
+            const uint8_t attr = m_attributes[i];
+            if((attr&attribute_inverse) || ((attr&attribute_blink) && m_blink_phase)) {
+                for(int x = 0;x<8;++x) {
+                    out[x]=~out[x];
+                }
+            }
+        }
+        // points the panel's start line at the first text row
+        void send_start_line() {
+            bus::begin_write();
+            uint8_t cmd = 0x40|((m_top*8)&0x3F);
+            panel::write_bytes(&cmd,1,false);
+            bus::end_write();
+        }
+        void new_line() {
+            m_column = 0;
+            if(m_row+1<rows) {
+                ++m_row;
+                return;
+            }
+            scroll(1);
+        }
+public:
+        ssd1306_console(const gfx::font& font) :
+                        m_initialized(false),
+                        m_font(font),
+                        m_contrast(0),
+                        m_top(0),
+                        m_column(0),
+                        m_row(0),
+                        m_attribute(0),
+                        m_blink_phase(false),
+                        m_blink_interval(500),
+                        m_blink_timestamp(0) {
+            memset(m_cells,' ',sizeof(m_cells));
+            memset(m_attributes,0,sizeof(m_attributes));
+            memset(m_dirty,0xFF,sizeof(m_dirty));
+        }
+        inline bool initialized() const {
+            return m_initialized;
+        }
+        // fails with gfx_result::not_supported unless the font is 8x8.
+        // Text written beforehand is kept where it was put
+        gfx::gfx_result initialize() {
+            if(!m_initialized) {
+                if(m_font.height()!=8 || m_font.find_char(' ').width()!=8) {
+                    return gfx::gfx_result::not_supported;
+                }
+                if(!panel::driver::initialize()) {
+                    return gfx::gfx_result::device_error;
+                }
+                bus::set_speed_multiplier(panel::write_speed_multiplier);
+                if(ResetBeforeInit && PinRst>=0) {
+                    digitalWrite(PinRst,HIGH);
+                    delay(1);
+                    digitalWrite(PinRst,LOW);
+                    delay(10);
+                    digitalWrite(PinRst,HIGH);
+                }
+                gfx::gfx_result r = panel::send_init_sequence(m_contrast);
+                if(r!=gfx::gfx_result::success) {
+                    return r;
+                }
+                memset(m_dirty,0xFF,sizeof(m_dirty));
+                m_initialized = true;
+                if(m_top!=0) {
+                    send_start_line();
+                }
+            }
+            return gfx::gfx_result::success;
+        }
+        // the attributes applied by subsequent put() and write() calls
+        inline uint8_t attributes() const {
+            return m_attribute;
+        }
+        inline void attributes(uint8_t value) {
+            m_attribute = value;
+        }
+        // how often blinking cells toggle, in milliseconds
+        inline uint32_t blink_interval() const {
+            return m_blink_interval;
+        }
+        inline void blink_interval(uint32_t value) {
+            m_blink_interval = value;
+        }
+        inline void cursor(uint16_t column,uint16_t row) {
+            m_column = column<columns?column:columns-1;
+            m_row = row<rows?row:rows-1;
+        }
+        // sets a cell. Only changed cells are sent on the next flush()
+        void put(uint16_t column,uint16_t row,char ch,uint8_t attributes) {
+            if(column>=columns || row>=rows) {
+                return;
+            }
+            const size_t i = index(column,(row+m_top)%rows);
+            if(m_cells[i]!=(uint8_t)ch || m_attributes[i]!=attributes) {
+                m_cells[i] = ch;
+                m_attributes[i] = attributes;
+                mark_dirty(i);
+            }
+        }
+        inline char get(uint16_t column,uint16_t row) const {
+            if(column>=columns || row>=rows) {
+                return 0;
+            }
+            return m_cells[index(column,(row+m_top)%rows)];
+        }
+        // writes text at the cursor, wrapping and scrolling as needed
+        void write(const char* text) {
+            for(const char* sz = text;*sz;++sz) {
+                const char ch = *sz;
+                if(ch=='\n') {
+                    new_line();
+                } else if(ch=='\r') {
+                    m_column = 0;
+                } else {
+                    if(m_column>=columns) {
+                        new_line();
+                    }
+                    put(m_column++,m_row,ch,m_attribute);
+                }
+            }
+        }
+        // clears every cell and homes the cursor
+        void clear() {
+            for(uint16_t r = 0;r<rows;++r) {
+                for(uint16_t c = 0;c<columns;++c) {
+                    put(c,r,' ',0);
+                }
+            }
+            m_column = 0;
+            m_row = 0;
+        }
+        // scrolls the text up. On 64 line panels this moves the panel's
+        // start line rather than resending the screen, so only the rows
+        // that scroll in are sent. The start line wraps at 64 lines, so
+        // shorter panels shift the cells and resend them instead
+        void scroll(uint16_t lines = 1) {
+            if(lines>rows) {
+                lines = rows;
+            }
+            if(!hardware_scroll) {
+                const size_t n = size_t(lines)*columns;
+                memmove(m_cells,m_cells+n,cell_count-n);
+                memmove(m_attributes,m_attributes+n,cell_count-n);
+                memset(m_cells+cell_count-n,' ',n);
+                memset(m_attributes+cell_count-n,0,n);
+                memset(m_dirty,0xFF,sizeof(m_dirty));
+                return;
+            }
+            for(uint16_t i = 0;i<lines;++i) {
+                const uint16_t row = m_top;
+                m_top = (m_top+1)%rows;
+                for(uint16_t c = 0;c<columns;++c) {
+                    const size_t j = index(c,row);
+                    m_cells[j] = ' ';
+                    m_attributes[j] = 0;
+                }
+                mark_row_dirty(row);
+            }
+            if(m_initialized) {
+                send_start_line();
+            }
+        }
+        // toggles blinking cells when their interval has elapsed and
+        // sends any dirty cells. Call this regularly
+        gfx::gfx_result update() {
+            if(millis()-m_blink_timestamp>=m_blink_interval) {
+                m_blink_timestamp = millis();
+                m_blink_phase = !m_blink_phase;
+                for(size_t i = 0;i<cell_count;++i) {
+                    if(m_attributes[i]&attribute_blink) {
+                        mark_dirty(i);
+                    }
+                }
+            }
+            return flush();
+        }
+        // sends the dirty cells. Runs of adjacent cells share one address
+        // window
+        gfx::gfx_result flush() {
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            uint8_t data[Width];
+            bus::begin_write();
+            for(uint16_t page = 0;page<rows;++page) {
+                uint16_t c = 0;
+                while(c<columns) {
+                    if(!is_dirty(index(c,page))) {
+                        ++c;
+                        continue;
+                    }
+                    const uint16_t start = c;
+                    while(c<columns && is_dirty(index(c,page))) {
+                        const size_t i = index(c,page);
+                        expand(i,data+(c-start)*8);
+                        m_dirty[i>>3]&=~(1<<(i&7));
+                        ++c;
+                    }
+                    panel::send_address(page,start*8,c*8-1);
+                    panel::write_bytes(data,(c-start)*8,true);
+                }
+            }
+            bus::end_write();
+            return gfx::gfx_result::success;
+        }
+    };
+}
+#endif // HTCW_SSD1306_CONSOLE_HPP
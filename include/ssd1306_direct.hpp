@@ -0,0 +1,185 @@
+#ifndef HTCW_SSD1306_DIRECT_HPP
+#define HTCW_SSD1306_DIRECT_HPP
+#include <ssd1306.hpp>
+namespace arduino {
+    // a write only driver for the SSD1306 with no frame buffer. Fills and
+    // images that cover whole pages are sent straight to the panel as an
+    // address window and a burst of data, so it uses a few bytes of RAM
+    // and each call costs only its bus time. Since the panel can't be
+    // read back, anything that would change part of a page is rejected
+    // with gfx_result::not_supported. Page based calls can't be misused
+    template<uint16_t Width,
+            uint16_t Height,
+            typename Bus,
+            uint8_t Address = 0x3C,
+            bool Vdc3_3=true,
+            uint32_t WriteSpeedPercent=400,
+            int8_t PinDC=-1,
+            int8_t PinRst=-1,
+            bool ResetBeforeInit=false>
+    struct ssd1306_direct final {
+        constexpr static const uint16_t width = Width;
+        constexpr static const uint16_t height = Height;
+        constexpr static const uint16_t pages = Height/8;
+private:
+        using panel = ssd1306<Width,Height,Bus,0,1,Address,Vdc3_3,WriteSpeedPercent,PinDC,PinRst,ResetBeforeInit>;
+        using bus = Bus;
+        bool m_initialized;
+        uint8_t m_contrast;
+        ssd1306_direct(const ssd1306_direct& rhs)=delete;
+        ssd1306_direct& operator=(const ssd1306_direct& rhs)=delete;
+        // sends a window of pages all set to value
+        static void send_fill(uint16_t x1,uint16_t p1,uint16_t x2,uint16_t p2,uint8_t value) {
+            uint8_t data[16];
+            memset(data,value,sizeof(data));
+            panel::send_address(p1,x1,x2);
+            size_t remaining = size_t(x2-x1+1)*(p2-p1+1);
+            while(remaining) {
+                const size_t n = remaining<sizeof(data)?remaining:sizeof(data);
+                panel::write_bytes(data,n,true);
+                remaining-=n;
+            }
+        }
+public:
+        using pixel_type = gfx::gsc_pixel<1>;
+        ssd1306_direct() : m_initialized(false),m_contrast(0) {
+        }
+        inline bool initialized() const {
+            return m_initialized;
+        }
+        // initializes the panel and clears it, since its RAM holds
+        // garbage at power up
+        gfx::gfx_result initialize() {
+            if(!m_initialized) {
+                if(!panel::driver::initialize()) {
+                    return gfx::gfx_result::device_error;
+                }
+                bus::set_speed_multiplier(panel::write_speed_multiplier);
+                if(ResetBeforeInit && PinRst>=0) {
+                    digitalWrite(PinRst,HIGH);
+                    delay(1);
+                    digitalWrite(PinRst,LOW);
+                    delay(10);
+                    digitalWrite(PinRst,HIGH);
+                }
+                gfx::gfx_result r = panel::send_init_sequence(m_contrast);
+                if(r!=gfx::gfx_result::success) {
+                    return r;
+                }
+                m_initialized = true;
+                bus::begin_write();
+                send_fill(0,0,width-1,pages-1,0);
+                bus::end_write();
+            }
+            return gfx::gfx_result::success;
+        }
+        constexpr inline gfx::size16 dimensions() const {
+            return gfx::size16(width,height);
+        }
+        constexpr inline gfx::rect16 bounds() const {
+            return dimensions().bounds();
+        }
+        // sets columns x1 to x2 of pages p1 to p2 to a page byte. Each bit
+        // is a row, LSB on top
+        gfx::gfx_result fill_pages(uint16_t x1,uint16_t p1,uint16_t x2,uint16_t p2,uint8_t value) {
+            if(x1>x2 || p1>p2 || x2>=width || p2>=pages) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            bus::begin_write();
+            send_fill(x1,p1,x2,p2,value);
+            bus::end_write();
+            return gfx::gfx_result::success;
+        }
+        // fills a rectangle whose top and bottom fall on page boundaries
+        gfx::gfx_result fill(const gfx::rect16& bounds,pixel_type color) {
+            if(!bounds.intersects(this->bounds())) {
+                return gfx::gfx_result::success;
+            }
+            const gfx::rect16 r = bounds.normalize().crop(this->bounds());
+            if((r.y1&7) || ((r.y2+1)&7)) {
+                return gfx::gfx_result::not_supported;
+            }
+            return fill_pages(r.x1,r.y1>>3,r.x2,r.y2>>3,color.native_value?0xFF:0);
+        }
+        inline gfx::gfx_result clear(const gfx::rect16& bounds) {
+            return fill(bounds,pixel_type());
+        }
+        // sends page-format bytes, a row of w bytes per page, to a window
+        // starting at column x of page. Nothing is clipped
+        gfx::gfx_result blit(uint16_t x,uint16_t page,uint16_t w,uint16_t page_count,const uint8_t* bits,bool pgm=true) {
+            if(bits==nullptr || w==0 || page_count==0 || x+w>width || page+page_count>pages) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            const size_t size = size_t(w)*page_count;
+            bus::begin_write();
+            panel::send_address(page,x,x+w-1);
+            if(pgm) {
+                panel::write_pgm_bytes(bits,size,true);
+            } else {
+                panel::write_bytes(bits,size,true);
+            }
+            bus::end_write();
+            return gfx::gfx_result::success;
+        }
+        // draws an ssd1306_image laid out for rotation 0 with its top on a
+        // page boundary, clipped to the panel. When its height isn't a
+        // multiple of 8 the rows below it in its last page are cleared,
+        // or set when inverted
+        gfx::gfx_result image(const ssd1306_image& img,gfx::spoint16 location,bool invert=false) {
+            if(img.data==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(img.rotation!=0) {
+                return gfx::gfx_result::invalid_format;
+            }
+            if(location.y&7) {
+                return gfx::gfx_result::not_supported;
+            }
+            gfx::gfx_result r = initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            const int ipages = (img.height+7)/8;
+            const int top = location.y/8;
+            int x1 = location.x, x2 = location.x+img.width-1;
+            int p1 = top, p2 = top+ipages-1;
+            x1 = x1<0?0:x1;
+            x2 = x2>=width?width-1:x2;
+            p1 = p1<0?0:p1;
+            p2 = p2>=pages?pages-1:p2;
+            if(x1>x2 || p1>p2) {
+                return gfx::gfx_result::success;
+            }
+            typename panel::image_reader reader(img);
+            const uint8_t xor_mask = invert?0xFF:0;
+            uint8_t line[Width];
+            bus::begin_write();
+            panel::send_address(p1,x1,x2);
+            // runs are read in order, so skipped bytes are still read
+            for(int sp = 0;sp<ipages && top+sp<=p2;++sp) {
+                const bool shown = top+sp>=p1;
+                for(int c = 0;c<img.width;++c) {
+                    const uint8_t b = reader.next()^xor_mask;
+                    const int x = location.x+c;
+                    if(shown && x>=x1 && x<=x2) {
+                        line[x-x1] = b;
+                    }
+                }
+                if(shown) {
+                    panel::write_bytes(line,x2-x1+1,true);
+                }
+            }
+            bus::end_write();
+            return gfx::gfx_result::success;
+        }
+    };
+}
+#endif // HTCW_SSD1306_DIRECT_HPP
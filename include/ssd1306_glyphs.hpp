@@ -0,0 +1,151 @@
+#ifndef HTCW_SSD1306_GLYPHS_HPP
+#define HTCW_SSD1306_GLYPHS_HPP
+#include <ssd1306.hpp>
+#include <gfx_font.hpp>
+namespace arduino {
+    // caches glyphs already converted to the display's native page layout
+    // and orientation, so drawing text is a run of masked byte copies
+    // into the frame buffer instead of a point() per pixel. Glyphs are
+    // converted the first time they're drawn, and the least recently
+    // used one is evicted when the cache is full. Glyphs at a y that
+    // isn't page aligned are shifted as they're copied. Glyphs larger
+    // than MaxSize in either dimension are clipped
+    template<typename Display,size_t Capacity = 32,uint16_t MaxSize = 16>
+    class ssd1306_glyph_cache final {
+        static_assert(Capacity>0,"Capacity must be at least 1");
+    public:
+        using display_type = Display;
+        using pixel_type = typename display_type::pixel_type;
+    private:
+        constexpr static const uint16_t max_pages = (MaxSize+7)/8;
+        struct entry {
+            const gfx::font* font;
+            int16_t ch;
+            // logical size
+            uint16_t width;
+            uint16_t height;
+            uint32_t stamp;
+            // page-format bits, (native height/8) rows of native width bytes
+            uint8_t bits[MaxSize*max_pages];
+        };
+        entry m_entries[Capacity];
+        uint32_t m_stamp;
+        ssd1306_glyph_cache(const ssd1306_glyph_cache& rhs)=delete;
+        ssd1306_glyph_cache& operator=(const ssd1306_glyph_cache& rhs)=delete;
+        // converts a glyph's rows into page-format columns in the
+        // orientation the panel stores them in
+        void convert(entry& e,const gfx::font& font,char ch) {
+            const gfx::font_char fc = font.find_char(ch);
+            const uint16_t fw = fc.width();
+            const uint16_t w = fw>MaxSize?MaxSize:fw;
+            const uint16_t h = font.height()>MaxSize?MaxSize:font.height();
+            const uint16_t nw = (display_type::rotation&1)?h:w;
+            const uint8_t* data = fc.data();
+            const size_t stride = (fw+7)/8;
+            e.font = &font;
+            e.ch = (uint8_t)ch;
+            e.width = w;
+            e.height = h;
+            memset(e.bits,0,sizeof(e.bits));
+            for(int gy = 0;gy<h;++gy) {
+                for(int gx = 0;gx<w;++gx) {
+                    if(!(pgm_read_byte(data+gy*stride+gx/8)&(0x80>>(gx&7)))) {
+                        continue;
+                    }
+                    int nx,ny;
+                    switch(display_type::rotation) {
+                        case 1:
+                            nx = gy;
+                            ny = w-1-gx;
+                            break;
+                        case 2:
+                            nx = w-1-gx;
+                            ny = h-1-gy;
+                            break;
+                        case 3:
+                            nx = h-1-gy;
+                            ny = gx;
+                            break;
+                        default:
+                            nx = gx;
+                            ny = gy;
+                            break;
+                    }
+                    e.bits[(ny>>3)*nw+nx]|=(1<<(ny&7));
+                }
+            }
+        }
+        entry& acquire(const gfx::font& font,char ch) {
+            entry* lru = &m_entries[0];
+            for(size_t i = 0;i<Capacity;++i) {
+                entry& e = m_entries[i];
+                if(e.font==&font && e.ch==(uint8_t)ch) {
+                    e.stamp = ++m_stamp;
+                    return e;
+                }
+                if(e.stamp<lru->stamp) {
+                    lru = &e;
+                }
+            }
+            convert(*lru,font,ch);
+            lru->stamp = ++m_stamp;
+            return *lru;
+        }
+        void draw_glyph(display_type& display,const entry& e,int x,int y,pixel_type color,pixel_type backcolor,bool transparent) {
+            // find the panel location of the glyph's top left corner
+            int x1 = x, y1 = y, x2 = x+e.width-1, y2 = y+e.height-1;
+            display_type::native(x1,y1);
+            display_type::native(x2,y2);
+            const int nx = x1<x2?x1:x2;
+            const int ny = y1<y2?y1:y2;
+            const bool odd = display_type::rotation&1;
+            display.blit_native(nx,ny,odd?e.height:e.width,odd?e.width:e.height,e.bits,nullptr,false,color.native_value,backcolor.native_value,transparent);
+        }
+    public:
+        ssd1306_glyph_cache() : m_stamp(0) {
+            clear();
+        }
+        // forgets every cached glyph
+        void clear() {
+            for(size_t i = 0;i<Capacity;++i) {
+                m_entries[i].font = nullptr;
+                m_entries[i].ch = -1;
+                m_entries[i].stamp = 0;
+            }
+        }
+        // draws text with its top left corner at location. '\n' starts a
+        // new line and '\r' returns to the start of the line. The display
+        // is flushed once afterward according to its update mode
+        gfx::gfx_result text(display_type& display,gfx::spoint16 location,const char* text,const gfx::font& font,pixel_type color,pixel_type backcolor=pixel_type(),bool transparent=true) {
+            if(text==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            gfx::gfx_result r = display.initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            const gfx::size16 dim = display.dimensions();
+            int x = location.x, y = location.y;
+            for(const char* sz = text;*sz;++sz) {
+                const char ch = *sz;
+                if(ch=='\n') {
+                    x = location.x;
+                    y+=font.height();
+                    continue;
+                }
+                if(ch=='\r') {
+                    x = location.x;
+                    continue;
+                }
+                const entry& e = acquire(font,ch);
+                if(x<dim.width && y<dim.height && x+e.width>0 && y+e.height>0) {
+                    draw_glyph(display,e,x,y,color,backcolor,transparent);
+                }
+                x+=e.width;
+            }
+            display.update_display();
+            return gfx::gfx_result::success;
+        }
+    };
+}
+#endif // HTCW_SSD1306_GLYPHS_HPP
@@ -0,0 +1,234 @@
+#ifndef HTCW_SSD1306_GROUP_HPP
+#define HTCW_SSD1306_GROUP_HPP
+#include <tuple>
+#include <type_traits>
+#include <ssd1306.hpp>
+namespace arduino {
+    // the order an ssd1306_group sends its panels' damage in
+    enum struct ssd1306_schedule {
+        // one page span from each panel in turn
+        round_robin = 0,
+        // each panel is drained before the next, in declaration order
+        priority
+    };
+    // coordinates several ssd1306 panels sharing one bus, such as panels at
+    // 0x3C and 0x3D, or panels behind an I2C multiplexer. Flushes happen in
+    // one bus session, and the bus speed is only changed when the next
+    // panel needs a different one. In mirror mode the first panel's frame
+    // buffer is sent to every panel
+    template<typename... Displays>
+    class ssd1306_group final {
+        static_assert(sizeof...(Displays)>0,"At least one display is required");
+        using first_type = typename std::tuple_element<0,std::tuple<Displays...>>::type;
+        using bus = typename first_type::bus;
+        template<typename... Ts> struct same_bus : std::true_type {};
+        template<typename T,typename... Ts> struct same_bus<T,Ts...> : std::integral_constant<bool,std::is_same<typename T::bus,bus>::value && same_bus<Ts...>::value> {};
+        static_assert(same_bus<Displays...>::value,"All displays must share the same bus");
+    public:
+        constexpr static const size_t count = sizeof...(Displays);
+        // called before talking to a panel, for example to switch an I2C
+        // multiplexer to the panel's channel
+        typedef void(*select_callback)(size_t index,void* state);
+    private:
+        std::tuple<Displays&...> m_displays;
+        ssd1306_schedule m_schedule;
+        bool m_mirror;
+        size_t m_next;
+        float m_speed;
+        select_callback m_select;
+        void* m_select_state;
+        ssd1306_group(const ssd1306_group& rhs)=delete;
+        ssd1306_group& operator=(const ssd1306_group& rhs)=delete;
+        // runs a functor against the display at a runtime index
+        template<typename Function>
+        inline void visit(size_t index,Function& fn) {
+            visit_impl(index,fn,std::integral_constant<size_t,0>());
+        }
+        template<typename Function,size_t I>
+        inline void visit_impl(size_t index,Function& fn,std::integral_constant<size_t,I>) {
+            if(index==I) {
+                fn(std::get<I>(m_displays));
+                return;
+            }
+            visit_impl(index,fn,std::integral_constant<size_t,I+1>());
+        }
+        template<typename Function>
+        inline void visit_impl(size_t,Function&,std::integral_constant<size_t,count>) {
+        }
+        // prepares the bus for the panel at index
+        template<typename Display>
+        void select(size_t index,Display& display) {
+            if(m_select!=nullptr) {
+                m_select(index,m_select_state);
+            }
+            if(display.write_speed_multiplier!=m_speed) {
+                bus::end_write();
+                bus::set_speed_multiplier(display.write_speed_multiplier);
+                m_speed = display.write_speed_multiplier;
+                bus::begin_write();
+            }
+        }
+        inline first_type& source() {
+            return std::get<0>(m_displays);
+        }
+        // sends at most max_bytes of one page span from one panel. Panels
+        // in temporal mode are skipped, since their service() sends whole
+        // planes
+        size_t send_page(size_t index,size_t max_bytes) {
+            size_t result = 0;
+            auto fn = [&](auto& display) {
+                if(display.m_temporal_mode!=ssd1306_temporal_mode::off) {
+                    return;
+                }
+                const int page = display.next_flush_page();
+                if(page==-1 || max_bytes<=display.window_overhead) {
+                    return;
+                }
+                this->select(index,display);
+                result = display.flush_page(page,max_bytes);
+                display.m_flush_cursor = page;
+            };
+            visit(index,fn);
+            return result;
+        }
+        // sends one page span of the first panel's frame buffer to every
+        // panel not in temporal mode, splitting max_bytes between them
+        size_t send_mirror_page(size_t max_bytes) {
+            first_type& src = source();
+            size_t targets = 0;
+            for(size_t i = 0;i<count;++i) {
+                auto fn = [&](auto& display) {
+                    if(display.m_temporal_mode==ssd1306_temporal_mode::off) {
+                        ++targets;
+                    }
+                };
+                visit(i,fn);
+            }
+            // with no panel to take it, the damage waits
+            if(targets==0) {
+                return 0;
+            }
+            const int page = src.next_flush_page();
+            const size_t share = max_bytes/targets;
+            if(page==-1 || share<=first_type::window_overhead) {
+                return 0;
+            }
+            const uint16_t x1 = src.m_dirty_x1[page];
+            uint16_t x2 = src.m_dirty_x2[page];
+            if(size_t(x2-x1+1)>share-first_type::window_overhead) {
+                x2 = x1+(share-first_type::window_overhead)-1;
+            }
+            for(size_t i = 0;i<count;++i) {
+                auto fn = [&](auto& display) {
+                    if(display.m_temporal_mode!=ssd1306_temporal_mode::off) {
+                        return;
+                    }
+                    this->select(i,display);
+                    display.send_window_from(src,page,page,x1,x2);
+                };
+                visit(i,fn);
+            }
+            if(x2==src.m_dirty_x2[page]) {
+                src.m_dirty_x1[page]=0xFF;
+                src.m_dirty_x2[page]=0;
+                src.m_priority[page]=false;
+            } else {
+                src.m_dirty_x1[page]=x2+1;
+            }
+            src.m_flush_cursor = page;
+            return (x2-x1+1+first_type::window_overhead)*targets;
+        }
+    public:
+        ssd1306_group(Displays&... displays) : m_displays(displays...),
+                                                m_schedule(ssd1306_schedule::round_robin),
+                                                m_mirror(false),
+                                                m_next(0),
+                                                m_speed(0),
+                                                m_select(nullptr),
+                                                m_select_state(nullptr) {
+        }
+        inline ssd1306_schedule schedule() const {
+            return m_schedule;
+        }
+        inline void schedule(ssd1306_schedule value) {
+            m_schedule = value;
+        }
+        // when true, the first panel's frame buffer is shown on every panel
+        inline bool mirror() const {
+            return m_mirror;
+        }
+        inline void mirror(bool value) {
+            m_mirror = value;
+        }
+        inline void on_select(select_callback callback,void* state=nullptr) {
+            m_select = callback;
+            m_select_state = state;
+        }
+        // initializes every panel
+        gfx::gfx_result initialize() {
+            gfx::gfx_result result = gfx::gfx_result::success;
+            for(size_t i = 0;i<count;++i) {
+                auto fn = [&](auto& display) {
+                    if(m_select!=nullptr) {
+                        m_select(i,m_select_state);
+                    }
+                    gfx::gfx_result r = display.initialize();
+                    if(r!=gfx::gfx_result::success) {
+                        result = r;
+                    }
+                };
+                visit(i,fn);
+            }
+            // initialize() sets the speed behind our back
+            m_speed = 0;
+            return result;
+        }
+        // sends every panel's pending damage in one bus session
+        gfx::gfx_result flush() {
+            return flush_some(size_t(-1));
+        }
+        // sends at most byte_budget bytes across all panels in one bus
+        // session, in the order given by schedule()
+        gfx::gfx_result flush_some(size_t byte_budget,size_t* out_bytes_sent=nullptr) {
+            size_t sent = 0;
+            bus::begin_write();
+            if(m_mirror) {
+                size_t n;
+                while(sent<byte_budget && 0!=(n=send_mirror_page(byte_budget-sent))) {
+                    sent+=n;
+                }
+            } else if(m_schedule==ssd1306_schedule::round_robin) {
+                bool any = true;
+                while(any && sent<byte_budget) {
+                    any = false;
+                    for(size_t i = 0;i<count && sent<byte_budget;++i) {
+                        const size_t n = send_page((m_next+i)%count,byte_budget-sent);
+                        if(n) {
+                            sent+=n;
+                            any = true;
+                        }
+                    }
+                    m_next = (m_next+1)%count;
+                }
+            } else {
+                for(size_t i = 0;i<count && sent<byte_budget;++i) {
+                    size_t n;
+                    while(sent<byte_budget && 0!=(n=send_page(i,byte_budget-sent))) {
+                        sent+=n;
+                    }
+                }
+            }
+            bus::end_write();
+            if(out_bytes_sent!=nullptr) {
+                *out_bytes_sent = sent;
+            }
+            return gfx::gfx_result::success;
+        }
+        // gets the display at the index
+        template<size_t Index>
+        inline typename std::tuple_element<Index,std::tuple<Displays...>>::type& display() {
+            return std::get<Index>(m_displays);
+        }
+    };
+}
+#endif // HTCW_SSD1306_GROUP_HPP
@@ -0,0 +1,172 @@
+#ifndef HTCW_SSD1306_IMAGE_CACHE_HPP
+#define HTCW_SSD1306_IMAGE_CACHE_HPP
+#include <io_stream.hpp>
+#include <gfx_drawing.hpp>
+#include <ssd1306.hpp>
+namespace arduino {
+    // remembers what images looked like in the frame buffer once they
+    // were decoded, keyed by source and destination, so drawing the same
+    // image again is a copy into the frame buffer instead of a full
+    // decode. Each entry holds every plane of the destination in page
+    // format, so grays survive and are dithered or thresholded when sent
+    // like anything else. 1-bit buffers are dithered while decoding, so
+    // there the dithering setting is part of the key too. The least
+    // recently used entries are evicted to stay within Budget bytes and
+    // Capacity entries
+    template<typename Display,size_t Budget=4096,size_t Capacity=8>
+    class ssd1306_image_cache final {
+        static_assert(Capacity>0,"Capacity must be at least 1");
+    public:
+        using display_type = Display;
+    private:
+        struct entry {
+            const void* key;
+            gfx::srect16 destination;
+            bool dithering;
+            gfx::rect16 rect;
+            uint32_t last_used;
+            size_t size;
+            uint8_t* data;
+        };
+        entry m_entries[Capacity];
+        size_t m_used;
+        uint32_t m_tick;
+        void*(*m_allocator)(size_t);
+        void(*m_deallocator)(void*);
+        ssd1306_image_cache(const ssd1306_image_cache& rhs)=delete;
+        ssd1306_image_cache& operator=(const ssd1306_image_cache& rhs)=delete;
+        void release(entry& e) {
+            if(e.data!=nullptr) {
+                m_deallocator(e.data);
+                m_used-=e.size;
+            }
+            e.key = nullptr;
+            e.data = nullptr;
+            e.size = 0;
+        }
+        entry* find(const void* key,const gfx::srect16& destination,bool dithering) {
+            for(size_t i = 0;i<Capacity;++i) {
+                entry& e = m_entries[i];
+                if(e.data!=nullptr && e.key==key && e.dithering==dithering &&
+                        e.destination.x1==destination.x1 && e.destination.y1==destination.y1 &&
+                        e.destination.x2==destination.x2 && e.destination.y2==destination.y2) {
+                    return &e;
+                }
+            }
+            return nullptr;
+        }
+        // frees least recently used entries until size more bytes fit,
+        // and returns a free slot, or null if it can't fit at all
+        entry* make_room(size_t size) {
+            if(size>Budget) {
+                return nullptr;
+            }
+            while(true) {
+                entry* lru = nullptr;
+                entry* free_slot = nullptr;
+                for(size_t i = 0;i<Capacity;++i) {
+                    entry& e = m_entries[i];
+                    if(e.data==nullptr) {
+                        free_slot = &e;
+                    } else if(lru==nullptr || e.last_used<lru->last_used) {
+                        lru = &e;
+                    }
+                }
+                if(free_slot!=nullptr && m_used+size<=Budget) {
+                    return free_slot;
+                }
+                if(lru==nullptr) {
+                    return nullptr;
+                }
+                release(*lru);
+            }
+        }
+    public:
+        ssd1306_image_cache(void*(allocator)(size_t)=::malloc,void(deallocator)(void*)=::free) :
+                            m_used(0),
+                            m_tick(0),
+                            m_allocator(allocator),
+                            m_deallocator(deallocator) {
+            for(size_t i = 0;i<Capacity;++i) {
+                m_entries[i].key = nullptr;
+                m_entries[i].data = nullptr;
+                m_entries[i].size = 0;
+            }
+        }
+        ~ssd1306_image_cache() {
+            clear();
+        }
+        // the bytes held by cached images
+        inline size_t used() const {
+            return m_used;
+        }
+        // drops every cached image
+        void clear() {
+            for(size_t i = 0;i<Capacity;++i) {
+                release(m_entries[i]);
+            }
+        }
+        // drops every cached image drawn from key
+        void invalidate(const void* key) {
+            for(size_t i = 0;i<Capacity;++i) {
+                if(m_entries[i].key==key) {
+                    release(m_entries[i]);
+                }
+            }
+        }
+        // draws an image, calling render() to decode it only when it isn't
+        // cached for this key and destination. key identifies the source
+        // and must stay valid while it's cached
+        template<typename Function>
+        gfx::gfx_result draw(display_type& display,const void* key,const gfx::srect16& destination,Function render) {
+            gfx::gfx_result r = display.initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            const gfx::srect16 sb = (gfx::srect16)display.bounds();
+            const gfx::srect16 dest = destination.normalize();
+            const bool dithering = display_type::bit_depth==1 && display.dithering();
+            entry* e = find(key,dest,dithering);
+            if(e!=nullptr) {
+                e->last_used = ++m_tick;
+                display.copy_in(e->rect,e->data);
+                display.update_display();
+                return gfx::gfx_result::success;
+            }
+            if(!sb.intersects(dest)) {
+                return render();
+            }
+            display.suspend();
+            r = render();
+            if(r==gfx::gfx_result::success) {
+                gfx::rect16 rect = (gfx::rect16)dest.crop(sb);
+                display_type::native(rect);
+                const size_t size = display_type::copy_size(rect);
+                e = make_room(size);
+                if(e!=nullptr) {
+                    e->data = (uint8_t*)m_allocator(size);
+                    if(e->data!=nullptr) {
+                        e->key = key;
+                        e->destination = dest;
+                        e->dithering = dithering;
+                        e->rect = rect;
+                        e->size = size;
+                        e->last_used = ++m_tick;
+                        m_used+=size;
+                        display.copy_out(rect,e->data);
+                    }
+                }
+            }
+            display.resume();
+            return r;
+        }
+        // draws the image in stream, decoding it from the stream's current
+        // position only when it isn't cached
+        inline gfx::gfx_result image(display_type& display,const gfx::srect16& destination,io::stream* stream) {
+            return draw(display,stream,destination,[&display,&destination,stream]() {
+                return gfx::draw::image(display,destination,stream);
+            });
+        }
+    };
+}
+#endif // HTCW_SSD1306_IMAGE_CACHE_HPP
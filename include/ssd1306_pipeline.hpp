@@ -0,0 +1,175 @@
+#ifndef HTCW_SSD1306_PIPELINE_HPP
+#define HTCW_SSD1306_PIPELINE_HPP
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <ssd1306.hpp>
+#ifdef ESP32
+#include <esp_pthread.h>
+#endif
+namespace arduino {
+    // flushes an ssd1306 with page packing on one thread (or core)
+    // and transmission on the calling thread. Packed pages are handed
+    // over through a lock free single producer/single consumer ring.
+    // The packing thread is started by the first flush() and kept until
+    // the pipeline is destroyed
+    template<typename Display,size_t Slots = 2>
+    class ssd1306_pipeline final {
+        static_assert(Slots>1,"Slots must be at least 2");
+        using display_type = Display;
+        using bus = typename display_type::bus;
+        constexpr static const uint16_t width = display_type::width;
+        constexpr static const uint16_t pages = display_type::pages;
+        struct window {
+            uint16_t p1;
+            uint16_t p2;
+            uint16_t x1;
+            uint16_t x2;
+        };
+        display_type& m_display;
+        int m_core;
+        uint8_t m_slots[Slots][width];
+        // both indices only ever increase. the producer owns m_head,
+        // the consumer owns m_tail
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+        // the windows of the flush being posted, guarded by m_lock
+        window m_windows[pages];
+        size_t m_window_count;
+        // hands each flush to the packing thread
+        std::mutex m_lock;
+        std::condition_variable m_signal;
+        uint32_t m_job;
+        bool m_stop;
+        std::thread m_producer;
+        ssd1306_pipeline(const ssd1306_pipeline& rhs)=delete;
+        ssd1306_pipeline& operator=(const ssd1306_pipeline& rhs)=delete;
+        void produce() {
+            uint32_t done = 0;
+            window windows[pages];
+            size_t count;
+            while(true) {
+                {
+                    std::unique_lock<std::mutex> guard(m_lock);
+                    m_signal.wait(guard,[this,done]() {
+                        return m_stop || m_job!=done;
+                    });
+                    if(m_stop) {
+                        return;
+                    }
+                    done = m_job;
+                    // the next flush may reuse the windows as soon as the
+                    // last page is taken
+                    count = m_window_count;
+                    memcpy(windows,m_windows,count*sizeof(window));
+                }
+                for(size_t i = 0;i<count;++i) {
+                    const window& w = windows[i];
+                    for(int page = w.p1;page<=w.p2;++page) {
+                        const size_t head = m_head.load(std::memory_order_relaxed);
+                        while(head-m_tail.load(std::memory_order_acquire)==Slots) {
+                            std::this_thread::yield();
+                        }
+                        m_display.pack_page(page,w.x1,w.x2,m_slots[head%Slots]);
+                        m_head.store(head+1,std::memory_order_release);
+                    }
+                }
+            }
+        }
+        void start() {
+#ifdef ESP32
+            // pinning goes through the global pthread defaults, so put
+            // back whatever they were for everyone else's threads
+            esp_pthread_cfg_t previous;
+            const bool had_previous = esp_pthread_get_cfg(&previous)==ESP_OK;
+            if(m_core>=0) {
+                esp_pthread_cfg_t cfg = had_previous?previous:esp_pthread_get_default_config();
+                cfg.pin_to_core = m_core;
+                esp_pthread_set_cfg(&cfg);
+            }
+#endif
+            m_producer = std::thread(&ssd1306_pipeline::produce,this);
+#ifdef ESP32
+            if(m_core>=0) {
+                if(!had_previous) {
+                    previous = esp_pthread_get_default_config();
+                }
+                esp_pthread_set_cfg(&previous);
+            }
+#endif
+        }
+    public:
+        // core is the core the packing thread is pinned to on the ESP32,
+        // or -1 to let the scheduler pick
+        ssd1306_pipeline(display_type& display,int core = -1) : m_display(display),
+                                                                m_core(core),
+                                                                m_head(0),
+                                                                m_tail(0),
+                                                                m_window_count(0),
+                                                                m_job(0),
+                                                                m_stop(false) {
+        }
+        ~ssd1306_pipeline() {
+            if(m_producer.joinable()) {
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_stop = true;
+                }
+                m_signal.notify_one();
+                m_producer.join();
+            }
+        }
+        // sends all pending damage, packing page N+1 while page N is sent
+        gfx::gfx_result flush() {
+            if(!m_display.initialized()) {
+                return gfx::gfx_result::invalid_state;
+            }
+            if(!display_type::dithered || m_display.m_temporal_mode!=ssd1306_temporal_mode::off) {
+                // 1-bit buffers are sent as is, so there's nothing to
+                // overlap, and in temporal mode service() sends the planes
+                return m_display.flush();
+            }
+            m_display.m_batch_count = 0;
+            size_t count = 0;
+            window windows[pages];
+            m_display.dirty_windows([&windows,&count](uint16_t p1,uint16_t p2,uint16_t x1,uint16_t x2) {
+                windows[count++] = window{p1,p2,x1,x2};
+            });
+            if(count==0) {
+                return gfx::gfx_result::success;
+            }
+            m_display.mark_clean();
+            if(!m_producer.joinable()) {
+                start();
+            }
+            // the producer doesn't touch the ring between flushes, so it's
+            // ours until the job is posted
+            m_head.store(0,std::memory_order_relaxed);
+            m_tail.store(0,std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                memcpy(m_windows,windows,count*sizeof(window));
+                m_window_count = count;
+                ++m_job;
+            }
+            m_signal.notify_one();
+            bus::begin_write();
+            for(size_t i = 0;i<count;++i) {
+                const window& w = windows[i];
+                m_display.send_address(w.p1,w.x1,w.x2);
+                for(int page = w.p1;page<=w.p2;++page) {
+                    const size_t tail = m_tail.load(std::memory_order_relaxed);
+                    while(m_head.load(std::memory_order_acquire)==tail) {
+                        std::this_thread::yield();
+                    }
+                    m_display.write_bytes(m_slots[tail%Slots],w.x2-w.x1+1,true);
+                    m_tail.store(tail+1,std::memory_order_release);
+                }
+            }
+            bus::end_write();
+            return gfx::gfx_result::success;
+        }
+    };
+}
+#endif // HTCW_SSD1306_PIPELINE_HPP
@@ -0,0 +1,295 @@
+#ifndef HTCW_SSD1306_SHARED_HPP
+#define HTCW_SSD1306_SHARED_HPP
+#include <atomic>
+#include <thread>
+#include <ssd1306.hpp>
+namespace arduino {
+    // lets several tasks draw to one ssd1306. Producers on any task post
+    // draw commands to a lock free bounded queue, and a single owner
+    // drains it with process() and sends the result with flush().
+    // Tasks may also draw to the display directly while holding a
+    // page_lock over the region they touch. The display is switched to
+    // manual updates, since only the owner may talk to the bus. Waits for
+    // queue room or a page back off to delay(), so a busy task can't
+    // starve a lower priority one, and give up after timeout()
+    // milliseconds with gfx_result::canceled
+    template<typename Display,size_t Capacity = 32>
+    class ssd1306_shared final {
+        static_assert(Capacity>1 && (Capacity&(Capacity-1))==0,"Capacity must be a power of 2");
+    public:
+        using display_type = Display;
+        using pixel_type = typename display_type::pixel_type;
+    private:
+        constexpr static const uint16_t pages = display_type::pages;
+        enum struct command_kind {
+            point = 0,
+            fill,
+            line,
+            ellipse,
+            filled_ellipse
+        };
+        struct command {
+            command_kind kind;
+            gfx::srect16 rect;
+            pixel_type color;
+        };
+        // bounded multi producer queue (after D. Vyukov). Each cell's
+        // sequence says whose turn it is to use it
+        struct cell {
+            std::atomic<size_t> sequence;
+            command cmd;
+        };
+        display_type& m_display;
+        cell m_cells[Capacity];
+        std::atomic<size_t> m_enqueue;
+        size_t m_dequeue;
+        std::atomic_flag m_page_locks[pages];
+        uint32_t m_timeout;
+        ssd1306_shared(const ssd1306_shared& rhs)=delete;
+        ssd1306_shared& operator=(const ssd1306_shared& rhs)=delete;
+        // retries attempt() until it succeeds or the timeout passes. The
+        // first few retries only yield, then each one sleeps a tick so
+        // tasks of any priority get to run
+        template<typename Function>
+        bool wait_for(Function attempt) const {
+            if(attempt()) {
+                return true;
+            }
+            const uint32_t start = millis();
+            for(int tries = 0;;++tries) {
+                if(millis()-start>=m_timeout) {
+                    return false;
+                }
+                if(tries<16) {
+                    std::this_thread::yield();
+                } else {
+                    delay(1);
+                }
+                if(attempt()) {
+                    return true;
+                }
+            }
+        }
+        bool try_post(const command& cmd) {
+            size_t pos = m_enqueue.load(std::memory_order_relaxed);
+            cell* c;
+            while(true) {
+                c = &m_cells[pos&(Capacity-1)];
+                const size_t seq = c->sequence.load(std::memory_order_acquire);
+                const intptr_t dif = intptr_t(seq)-intptr_t(pos);
+                if(dif==0) {
+                    if(m_enqueue.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if(dif<0) {
+                    return false;
+                } else {
+                    pos = m_enqueue.load(std::memory_order_relaxed);
+                }
+            }
+            c->cmd = cmd;
+            c->sequence.store(pos+1,std::memory_order_release);
+            return true;
+        }
+        gfx::gfx_result post(command_kind kind,const gfx::srect16& rect,pixel_type color) {
+            command cmd;
+            cmd.kind = kind;
+            cmd.rect = rect;
+            cmd.color = color;
+            // wait for the owner to make room rather than drop drawing
+            if(!wait_for([this,&cmd]() { return try_post(cmd); })) {
+                return gfx::gfx_result::canceled;
+            }
+            return gfx::gfx_result::success;
+        }
+        // gets the next command without taking it
+        const command* peek() const {
+            const cell* c = &m_cells[m_dequeue&(Capacity-1)];
+            const size_t seq = c->sequence.load(std::memory_order_acquire);
+            if(intptr_t(seq)-intptr_t(m_dequeue+1)<0) {
+                return nullptr;
+            }
+            return &c->cmd;
+        }
+        // hands the cell peek() returned back to the producers
+        void take() {
+            m_cells[m_dequeue&(Capacity-1)].sequence.store(m_dequeue+Capacity,std::memory_order_release);
+            ++m_dequeue;
+        }
+        // gets the native page range under a logical rectangle
+        bool page_range(const gfx::srect16& rect,uint16_t* out_p1,uint16_t* out_p2) const {
+            const gfx::srect16 b = (gfx::srect16)m_display.bounds();
+            const gfx::srect16 r = rect.normalize();
+            if(!b.intersects(r)) {
+                return false;
+            }
+            gfx::rect16 nr = (gfx::rect16)r.crop(b);
+            display_type::native(nr);
+            *out_p1 = nr.y1>>3;
+            *out_p2 = nr.y2>>3;
+            return true;
+        }
+        // returns false if a page couldn't be had in time, with none of
+        // them held
+        bool lock_pages(uint16_t p1,uint16_t p2) {
+            // always lock in ascending order so two locks can't deadlock
+            for(int page = p1;page<=p2;++page) {
+                std::atomic_flag& lock = m_page_locks[page];
+                if(!wait_for([&lock]() { return !lock.test_and_set(std::memory_order_acquire); })) {
+                    if(page>p1) {
+                        unlock_pages(p1,page-1);
+                    }
+                    return false;
+                }
+            }
+            return true;
+        }
+        void unlock_pages(uint16_t p1,uint16_t p2) {
+            for(int page = p1;page<=p2;++page) {
+                m_page_locks[page].clear(std::memory_order_release);
+            }
+        }
+        // returns false, leaving the command queued, if its pages stayed
+        // locked past the timeout
+        bool apply(const command& cmd) {
+            gfx::srect16 extent = cmd.rect;
+            if(cmd.kind==command_kind::point) {
+                extent = gfx::srect16(cmd.rect.x1,cmd.rect.y1,cmd.rect.x1,cmd.rect.y1);
+            }
+            uint16_t p1,p2;
+            if(!page_range(extent,&p1,&p2)) {
+                return true;
+            }
+            if(!lock_pages(p1,p2)) {
+                return false;
+            }
+            switch(cmd.kind) {
+                case command_kind::point:
+                    m_display.point(gfx::point16(cmd.rect.x1,cmd.rect.y1),cmd.color);
+                    break;
+                case command_kind::fill:
+                    m_display.fill((gfx::rect16)cmd.rect.normalize().crop((gfx::srect16)m_display.bounds()),cmd.color);
+                    break;
+                case command_kind::line:
+                    m_display.line(cmd.rect,cmd.color);
+                    break;
+                case command_kind::ellipse:
+                    m_display.ellipse(cmd.rect,cmd.color);
+                    break;
+                case command_kind::filled_ellipse:
+                    m_display.filled_ellipse(cmd.rect,cmd.color);
+                    break;
+            }
+            unlock_pages(p1,p2);
+            return true;
+        }
+    public:
+        // holds the pages under a region so a task can draw to the
+        // display directly. Only draw inside the locked region, and only
+        // if result() is success
+        class page_lock final {
+            ssd1306_shared& m_shared;
+            uint16_t m_p1;
+            uint16_t m_p2;
+            bool m_locked;
+            gfx::gfx_result m_result;
+            page_lock(const page_lock& rhs)=delete;
+            page_lock& operator=(const page_lock& rhs)=delete;
+        public:
+            page_lock(ssd1306_shared& shared,const gfx::srect16& region) : m_shared(shared),m_result(gfx::gfx_result::success) {
+                m_locked = m_shared.page_range(region,&m_p1,&m_p2);
+                if(m_locked && !m_shared.lock_pages(m_p1,m_p2)) {
+                    m_locked = false;
+                    m_result = gfx::gfx_result::canceled;
+                }
+            }
+            // canceled if the pages stayed locked past the timeout
+            inline gfx::gfx_result result() const {
+                return m_result;
+            }
+            ~page_lock() {
+                if(m_locked) {
+                    m_shared.unlock_pages(m_p1,m_p2);
+                }
+            }
+        };
+        // the display must be initialized before producers start
+        ssd1306_shared(display_type& display) : m_display(display),m_enqueue(0),m_dequeue(0),m_timeout(1000) {
+            for(size_t i = 0;i<Capacity;++i) {
+                m_cells[i].sequence.store(i,std::memory_order_relaxed);
+            }
+            for(int page = 0;page<pages;++page) {
+                m_page_locks[page].clear();
+            }
+            m_display.update_mode(ssd1306_update_mode::manual);
+        }
+        inline display_type& display() {
+            return m_display;
+        }
+        // the milliseconds any call waits for queue room or a page before
+        // it gives up. 0 makes every call a single try. Set it before
+        // other tasks start
+        inline uint32_t timeout() const {
+            return m_timeout;
+        }
+        inline void timeout(uint32_t value) {
+            m_timeout = value;
+        }
+        // producer side. safe to call from any task
+        inline gfx::gfx_result point(gfx::point16 location,pixel_type color) {
+            return post(command_kind::point,gfx::srect16(location.x,location.y,location.x,location.y),color);
+        }
+        inline gfx::gfx_result fill(const gfx::rect16& bounds,pixel_type color) {
+            return post(command_kind::fill,(gfx::srect16)bounds,color);
+        }
+        inline gfx::gfx_result clear(const gfx::rect16& bounds) {
+            pixel_type p;
+            return fill(bounds,p);
+        }
+        inline gfx::gfx_result line(const gfx::srect16& endpoints,pixel_type color) {
+            return post(command_kind::line,endpoints,color);
+        }
+        inline gfx::gfx_result ellipse(const gfx::srect16& rect,pixel_type color) {
+            return post(command_kind::ellipse,rect,color);
+        }
+        inline gfx::gfx_result filled_ellipse(const gfx::srect16& rect,pixel_type color) {
+            return post(command_kind::filled_ellipse,rect,color);
+        }
+        // owner side. applies up to max_commands queued commands and
+        // returns how many were applied. Stops early, leaving the rest
+        // queued, when a command's pages stay locked past the timeout
+        size_t process(size_t max_commands = Capacity) {
+            size_t result = 0;
+            const command* cmd;
+            while(result<max_commands && nullptr!=(cmd = peek())) {
+                if(!apply(*cmd)) {
+                    break;
+                }
+                take();
+                ++result;
+            }
+            return result;
+        }
+        // owner side. sends the damage one page at a time, holding
+        // only that page's lock while it is sent. Pages that stay locked
+        // past the timeout keep their damage and the result is canceled
+        gfx::gfx_result flush() {
+            if(!m_display.initialized()) {
+                return gfx::gfx_result::invalid_state;
+            }
+            gfx::gfx_result result = gfx::gfx_result::success;
+            display_type::bus::begin_write();
+            for(int page = 0;page<pages;++page) {
+                if(!lock_pages(page,page)) {
+                    result = gfx::gfx_result::canceled;
+                    continue;
+                }
+                m_display.flush_page(page,size_t(-1));
+                unlock_pages(page,page);
+            }
+            display_type::bus::end_write();
+            return result;
+        }
+    };
+}
+#endif // HTCW_SSD1306_SHARED_HPP
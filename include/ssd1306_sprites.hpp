@@ -0,0 +1,361 @@
+#ifndef HTCW_SSD1306_SPRITES_HPP
+#define HTCW_SSD1306_SPRITES_HPP
+#include <ssd1306.hpp>
+namespace arduino {
+    // draws masked sprites over whatever is in the frame buffer. Each
+    // sprite keeps a copy of the pages under it, so moving it restores the
+    // background without redrawing it. Changes are composed in update(),
+    // in z order, and only the old and new footprints of the sprites that
+    // changed are sent. Draw the background between erase() and update()
+    template<typename Display,size_t Capacity=32>
+    class ssd1306_sprites final {
+        static_assert(Capacity>0 && Capacity<256,"Capacity must be between 1 and 255");
+    public:
+        using display_type = Display;
+    private:
+        struct sprite {
+            const ssd1306_masked_image* image;
+            gfx::spoint16 location;
+            int16_t z;
+            bool used;
+            bool visible;
+            bool changed;
+            bool drawn;
+            // the panel rectangle last drawn, clipped
+            gfx::rect16 shown;
+            uint8_t* under;
+            size_t under_size;
+        };
+        display_type& m_display;
+        sprite m_sprites[Capacity];
+        uint8_t m_order[Capacity];
+        size_t m_count;
+        bool m_changed;
+        bool m_reorder;
+        void*(*m_allocator)(size_t);
+        void(*m_deallocator)(void*);
+        ssd1306_sprites(const ssd1306_sprites& rhs)=delete;
+        ssd1306_sprites& operator=(const ssd1306_sprites& rhs)=delete;
+        // the bytes needed to save the pages under an image anywhere
+        static size_t under_size(const ssd1306_masked_image& image) {
+            const bool odd = image.rotation&1;
+            const size_t nw = odd?image.height:image.width;
+            const size_t nh = odd?image.width:image.height;
+            return display_type::bit_depth*nw*((nh+7)/8+1);
+        }
+        // finds the clipped panel rectangle a sprite covers. Returns false
+        // if it's off screen
+        static bool footprint(const sprite& s,gfx::rect16* out) {
+            int x1 = s.location.x, y1 = s.location.y;
+            int x2 = x1+s.image->width-1, y2 = y1+s.image->height-1;
+            display_type::native(x1,y1);
+            display_type::native(x2,y2);
+            if(x1>x2) {
+                const int tmp = x1; x1 = x2; x2 = tmp;
+            }
+            if(y1>y2) {
+                const int tmp = y1; y1 = y2; y2 = tmp;
+            }
+            if(x2<0 || y2<0 || x1>=display_type::width || y1>=display_type::height) {
+                return false;
+            }
+            out->x1 = x1<0?0:x1;
+            out->y1 = y1<0?0:y1;
+            out->x2 = x2>=display_type::width?display_type::width-1:x2;
+            out->y2 = y2>=display_type::height?display_type::height-1:y2;
+            return true;
+        }
+        // copies the whole page bytes under rect in every plane to or
+        // from the save-under buffer
+        void transfer(const gfx::rect16& rect,uint8_t* under,bool save) {
+            const size_t w = rect.x2-rect.x1+1;
+            for(size_t i = 0;i<display_type::bit_depth;++i) {
+                for(int page = rect.y1>>3;page<=(rect.y2>>3);++page) {
+                    uint8_t* p = m_display.m_frame_buffer+i*display_type::plane_size+page*display_type::width+rect.x1;
+                    if(save) {
+                        memcpy(under,p,w);
+                    } else {
+                        memcpy(p,under,w);
+                    }
+                    under+=w;
+                }
+            }
+        }
+        void draw(sprite& s) {
+            s.drawn = s.visible && footprint(s,&s.shown);
+            if(!s.drawn) {
+                return;
+            }
+            transfer(s.shown,s.under,true);
+            int x1 = s.location.x, y1 = s.location.y;
+            int x2 = x1+s.image->width-1, y2 = y1+s.image->height-1;
+            display_type::native(x1,y1);
+            display_type::native(x2,y2);
+            const bool odd = display_type::rotation&1;
+            const bool pgm = !(s.image->flags&ssd1306_masked_image::flag_ram);
+            m_display.blit_native(x1<x2?x1:x2,y1<y2?y1:y2,
+                                odd?s.image->height:s.image->width,
+                                odd?s.image->width:s.image->height,
+                                s.image->bits,s.image->mask,pgm,
+                                typename display_type::value_type((1<<display_type::bit_depth)-1),0,false);
+        }
+        // merges overlapping rectangles in place and returns how many are
+        // left, so no column is sent twice
+        static size_t merge(gfx::rect16* rects,size_t count) {
+            bool merged = true;
+            while(merged) {
+                merged = false;
+                for(size_t i = 0;i<count;++i) {
+                    for(size_t j = i+1;j<count;++j) {
+                        gfx::rect16& a = rects[i];
+                        const gfx::rect16& b = rects[j];
+                        // overlap is counted in whole pages, since that's
+                        // what gets sent
+                        if(a.x1>b.x2 || b.x1>a.x2 || (a.y1>>3)>(b.y2>>3) || (b.y1>>3)>(a.y2>>3)) {
+                            continue;
+                        }
+                        a.x1 = a.x1<b.x1?a.x1:b.x1;
+                        a.y1 = a.y1<b.y1?a.y1:b.y1;
+                        a.x2 = a.x2>b.x2?a.x2:b.x2;
+                        a.y2 = a.y2>b.y2?a.y2:b.y2;
+                        rects[j] = rects[--count];
+                        merged = true;
+                        --j;
+                    }
+                }
+            }
+            return count;
+        }
+        void sort() {
+            m_count = 0;
+            for(size_t i = 0;i<Capacity;++i) {
+                if(!m_sprites[i].used) {
+                    continue;
+                }
+                size_t j = m_count++;
+                while(j>0 && m_sprites[m_order[j-1]].z>m_sprites[i].z) {
+                    m_order[j] = m_order[j-1];
+                    --j;
+                }
+                m_order[j] = uint8_t(i);
+            }
+            m_reorder = false;
+        }
+        inline sprite* get(size_t id) {
+            return id<Capacity && m_sprites[id].used?&m_sprites[id]:nullptr;
+        }
+        inline void changed(sprite& s) {
+            s.changed = true;
+            m_changed = true;
+        }
+    public:
+        ssd1306_sprites(display_type& display,void*(allocator)(size_t)=::malloc,void(deallocator)(void*)=::free) :
+                        m_display(display),
+                        m_count(0),
+                        m_changed(false),
+                        m_reorder(false),
+                        m_allocator(allocator),
+                        m_deallocator(deallocator) {
+            for(size_t i = 0;i<Capacity;++i) {
+                m_sprites[i].used = false;
+                m_sprites[i].visible = false;
+                m_sprites[i].changed = false;
+                m_sprites[i].drawn = false;
+                m_sprites[i].under = nullptr;
+                m_sprites[i].under_size = 0;
+            }
+        }
+        ~ssd1306_sprites() {
+            for(size_t i = 0;i<Capacity;++i) {
+                if(m_sprites[i].under!=nullptr) {
+                    m_deallocator(m_sprites[i].under);
+                }
+            }
+        }
+        // adds a sprite, shown on the next update(). Sprites with a higher
+        // z are drawn over those with a lower one. The image must be laid
+        // out for the display's rotation and stay valid while in use
+        gfx::gfx_result add(const ssd1306_masked_image& image,gfx::spoint16 location,int16_t z,size_t* out_id) {
+            if(out_id==nullptr || image.bits==nullptr || image.mask==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(image.rotation!=display_type::rotation) {
+                return gfx::gfx_result::invalid_format;
+            }
+            for(size_t i = 0;i<Capacity;++i) {
+                sprite& s = m_sprites[i];
+                // a removed sprite keeps its slot until it's erased
+                if(s.used || s.drawn) {
+                    continue;
+                }
+                const size_t size = under_size(image);
+                if(s.under_size<size) {
+                    if(s.under!=nullptr) {
+                        m_deallocator(s.under);
+                    }
+                    s.under = (uint8_t*)m_allocator(size);
+                    s.under_size = s.under==nullptr?0:size;
+                    if(s.under==nullptr) {
+                        return gfx::gfx_result::out_of_memory;
+                    }
+                }
+                s.image = &image;
+                s.location = location;
+                s.z = z;
+                s.used = true;
+                s.visible = true;
+                s.drawn = false;
+                changed(s);
+                m_reorder = true;
+                *out_id = i;
+                return gfx::gfx_result::success;
+            }
+            return gfx::gfx_result::out_of_memory;
+        }
+        // removes a sprite on the next update()
+        gfx::gfx_result remove(size_t id) {
+            sprite* s = get(id);
+            if(s==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            s->visible = false;
+            s->used = false;
+            m_reorder = true;
+            changed(*s);
+            return gfx::gfx_result::success;
+        }
+        gfx::gfx_result move(size_t id,gfx::spoint16 location) {
+            sprite* s = get(id);
+            if(s==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(s->location.x!=location.x || s->location.y!=location.y) {
+                s->location = location;
+                changed(*s);
+            }
+            return gfx::gfx_result::success;
+        }
+        gfx::gfx_result visible(size_t id,bool value) {
+            sprite* s = get(id);
+            if(s==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(s->visible!=value) {
+                s->visible = value;
+                changed(*s);
+            }
+            return gfx::gfx_result::success;
+        }
+        gfx::gfx_result z(size_t id,int16_t value) {
+            sprite* s = get(id);
+            if(s==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(s->z!=value) {
+                s->z = value;
+                m_reorder = true;
+                changed(*s);
+            }
+            return gfx::gfx_result::success;
+        }
+        // swaps a sprite's image, such as for the next animation frame
+        gfx::gfx_result image(size_t id,const ssd1306_masked_image& image) {
+            sprite* s = get(id);
+            if(s==nullptr || image.bits==nullptr || image.mask==nullptr) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            if(image.rotation!=display_type::rotation) {
+                return gfx::gfx_result::invalid_format;
+            }
+            if(s->under_size<under_size(image)) {
+                return gfx::gfx_result::out_of_memory;
+            }
+            s->image = &image;
+            changed(*s);
+            return gfx::gfx_result::success;
+        }
+        // restores the background under every sprite. The next update()
+        // draws them again
+        void erase() {
+            for(size_t i = m_count;i>0;--i) {
+                sprite& s = m_sprites[m_order[i-1]];
+                if(s.drawn) {
+                    transfer(s.shown,s.under,false);
+                    m_display.mark_dirty(s.shown);
+                    s.drawn = false;
+                    changed(s);
+                }
+            }
+        }
+        // composes the sprites that changed and sends only their old and
+        // new footprints, each in its own window rather than as one span
+        // per page. When the display is holding damage back they're only
+        // marked instead
+        gfx::gfx_result update() {
+            gfx::gfx_result r = m_display.initialize();
+            if(r!=gfx::gfx_result::success) {
+                return r;
+            }
+            if(!m_changed) {
+                return gfx::gfx_result::success;
+            }
+            // sprites that didn't change come back exactly as they were, so
+            // keep their damage out of the flush
+            uint8_t dirty_x1[display_type::pages];
+            uint8_t dirty_x2[display_type::pages];
+            memcpy(dirty_x1,m_display.m_dirty_x1,sizeof(dirty_x1));
+            memcpy(dirty_x2,m_display.m_dirty_x2,sizeof(dirty_x2));
+            gfx::rect16 damage[Capacity*2];
+            size_t damage_count = 0;
+            for(size_t i = m_count;i>0;--i) {
+                sprite& s = m_sprites[m_order[i-1]];
+                if(s.drawn) {
+                    transfer(s.shown,s.under,false);
+                    if(s.changed) {
+                        damage[damage_count++] = s.shown;
+                    }
+                    s.drawn = false;
+                }
+            }
+            if(m_reorder) {
+                sort();
+            }
+            for(size_t i = 0;i<m_count;++i) {
+                sprite& s = m_sprites[m_order[i]];
+                draw(s);
+                if(s.changed && s.drawn) {
+                    damage[damage_count++] = s.shown;
+                }
+            }
+            memcpy(m_display.m_dirty_x1,dirty_x1,sizeof(dirty_x1));
+            memcpy(m_display.m_dirty_x2,dirty_x2,sizeof(dirty_x2));
+            const bool send = m_display.m_suspend_count==0 &&
+                            m_display.m_update_mode!=ssd1306_update_mode::manual &&
+                            m_display.m_temporal_mode==ssd1306_temporal_mode::off;
+            if(send) {
+                damage_count = merge(damage,damage_count);
+                display_type::bus::begin_write();
+                for(size_t i = 0;i<damage_count;++i) {
+                    const gfx::rect16& d = damage[i];
+                    // footprints erase() marked are sent here, so keep
+                    // update_display() from sending them again
+                    m_display.trim_dirty(d.y1>>3,d.y2>>3,d.x1,d.x2);
+                    m_display.send_window(d.y1>>3,d.y2>>3,d.x1,d.x2);
+                }
+                display_type::bus::end_write();
+            } else {
+                for(size_t i = 0;i<damage_count;++i) {
+                    m_display.mark_dirty(damage[i]);
+                }
+            }
+            for(size_t i = 0;i<Capacity;++i) {
+                m_sprites[i].changed = false;
+            }
+            m_changed = false;
+            // anything else drawn since the last flush
+            m_display.update_display();
+            return gfx::gfx_result::success;
+        }
+    };
+}
+#endif // HTCW_SSD1306_SPRITES_HPP
@@ -0,0 +1,307 @@
+#ifndef HTCW_SSD1306_TILED_HPP
+#define HTCW_SSD1306_TILED_HPP
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <ssd1306.hpp>
+#if __has_include(<thread>)
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#define SSD1306_TILED_THREADS
+#endif
+namespace arduino {
+    // presents several ssd1306 panels as one draw target, laid out in
+    // Columns x Rows tiles in row major order. Every tile must be the same
+    // size. Drawing is clipped per tile and each panel tracks its own
+    // damage. Primitives are handed to each panel they cross exactly once,
+    // so nothing is dispatched per pixel. Where threads are available,
+    // the panels on each bus are flushed by that bus's own worker, so
+    // different buses are sent in parallel
+    template<size_t Columns,size_t Rows,typename... Tiles>
+    class ssd1306_tiled final {
+        static_assert(Columns>0 && Rows>0,"Columns and Rows must be at least 1");
+        static_assert(sizeof...(Tiles)==Columns*Rows,"There must be Columns x Rows tiles");
+        using first_type = typename std::tuple_element<0,std::tuple<Tiles...>>::type;
+        template<typename... Ts> struct same_pixel : std::true_type {};
+        template<typename T,typename... Ts> struct same_pixel<T,Ts...> : std::integral_constant<bool,std::is_same<typename T::pixel_type,typename first_type::pixel_type>::value && same_pixel<Ts...>::value> {};
+        static_assert(same_pixel<Tiles...>::value,"All tiles must have the same pixel type");
+        constexpr static const size_t count = sizeof...(Tiles);
+        // tiles are grouped by bus. Each group is led by the first tile on
+        // that bus
+        using buses = std::tuple<typename Tiles::bus...>;
+        template<size_t I,size_t J = 0>
+        struct leader_of : std::conditional<std::is_same<typename std::tuple_element<I,buses>::type,typename std::tuple_element<J,buses>::type>::value,
+                                            std::integral_constant<size_t,J>,
+                                            leader_of<I,J+1>>::type {};
+        template<size_t... I>
+        static size_t leader(size_t index,std::index_sequence<I...>) {
+            static const size_t leaders[] = {leader_of<I>::value...};
+            return leaders[index];
+        }
+        static inline size_t leader(size_t index) {
+            return leader(index,std::index_sequence_for<Tiles...>());
+        }
+        std::tuple<Tiles&...> m_tiles;
+#ifdef SSD1306_TILED_THREADS
+        // a worker per bus but the first one's, which the caller flushes
+        std::thread m_workers[count];
+        gfx::gfx_result m_results[count];
+        std::mutex m_lock;
+        std::condition_variable m_start;
+        std::condition_variable m_done;
+        uint32_t m_job;
+        size_t m_pending;
+        bool m_stop;
+        bool m_started;
+#endif
+        ssd1306_tiled(const ssd1306_tiled& rhs)=delete;
+        ssd1306_tiled& operator=(const ssd1306_tiled& rhs)=delete;
+        // runs fn(tile,bounds) for every tile, where bounds is the
+        // tile's rectangle in the virtual coordinate space
+        template<typename Function,size_t... I>
+        inline void for_each_impl(Function& fn,std::index_sequence<I...>) {
+            int dummy[] = {0,(fn(std::get<I>(m_tiles),tile_bounds(I)),0)...};
+            (void)dummy;
+        }
+        template<typename Function>
+        inline void for_each(Function& fn) {
+            for_each_impl(fn,std::index_sequence_for<Tiles...>());
+        }
+        // flushes the tiles on one bus, in order
+        template<size_t... I>
+        gfx::gfx_result flush_bus_impl(size_t bus_leader,std::index_sequence<I...>) {
+            gfx::gfx_result result = gfx::gfx_result::success;
+            int dummy[] = {0,(leader(I)==bus_leader?(result = combine(result,std::get<I>(m_tiles).flush()),0):0)...};
+            (void)dummy;
+            return result;
+        }
+        inline gfx::gfx_result flush_bus(size_t bus_leader) {
+            return flush_bus_impl(bus_leader,std::index_sequence_for<Tiles...>());
+        }
+#ifdef SSD1306_TILED_THREADS
+        inline static size_t worker_count() {
+            size_t result = 0;
+            for(size_t i = 1;i<count;++i) {
+                if(leader(i)==i) {
+                    ++result;
+                }
+            }
+            return result;
+        }
+        // waits for each flush() and sends its bus's tiles
+        void work(size_t bus_leader) {
+            uint32_t done = 0;
+            while(true) {
+                {
+                    std::unique_lock<std::mutex> guard(m_lock);
+                    m_start.wait(guard,[this,done]() {
+                        return m_stop || m_job!=done;
+                    });
+                    if(m_stop) {
+                        return;
+                    }
+                    done = m_job;
+                }
+                const gfx::gfx_result r = flush_bus(bus_leader);
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_results[bus_leader] = r;
+                    --m_pending;
+                }
+                m_done.notify_one();
+            }
+        }
+        void start() {
+            for(size_t i = 1;i<count;++i) {
+                if(leader(i)==i) {
+                    m_workers[i] = std::thread(&ssd1306_tiled::work,this,i);
+                }
+            }
+            m_started = true;
+        }
+#endif
+        inline gfx::size16 tile_size() const {
+            return std::get<0>(m_tiles).dimensions();
+        }
+        inline gfx::srect16 tile_bounds(size_t index) const {
+            const gfx::size16 ts = tile_size();
+            const int16_t x = int16_t((index%Columns)*ts.width);
+            const int16_t y = int16_t((index/Columns)*ts.height);
+            return gfx::srect16(x,y,x+ts.width-1,y+ts.height-1);
+        }
+        static gfx::gfx_result combine(gfx::gfx_result lhs,gfx::gfx_result rhs) {
+            return lhs!=gfx::gfx_result::success?lhs:rhs;
+        }
+    public:
+#ifdef SSD1306_TILED_THREADS
+        ssd1306_tiled(Tiles&... tiles) : m_tiles(tiles...),m_job(0),m_pending(0),m_stop(false),m_started(false) {
+        }
+        ~ssd1306_tiled() {
+            if(m_started) {
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_stop = true;
+                }
+                m_start.notify_all();
+                for(size_t i = 1;i<count;++i) {
+                    if(m_workers[i].joinable()) {
+                        m_workers[i].join();
+                    }
+                }
+            }
+        }
+#else
+        ssd1306_tiled(Tiles&... tiles) : m_tiles(tiles...) {
+        }
+#endif
+        // gets the tile at the index
+        template<size_t Index>
+        inline typename std::tuple_element<Index,std::tuple<Tiles...>>::type& tile() {
+            return std::get<Index>(m_tiles);
+        }
+        gfx::gfx_result initialize() {
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                (void)tb;
+                result = combine(result,tile.initialize());
+            };
+            for_each(fn);
+            return result;
+        }
+        // sends every panel's damage. Panels on the same bus are sent in
+        // turn and different buses concurrently. The workers are started
+        // by the first flush() and kept until this is destroyed
+        gfx::gfx_result flush() {
+#ifdef SSD1306_TILED_THREADS
+            const size_t workers = worker_count();
+            if(workers>0) {
+                if(!m_started) {
+                    start();
+                }
+                {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_pending = workers;
+                    ++m_job;
+                }
+                m_start.notify_all();
+                gfx::gfx_result result = flush_bus(0);
+                std::unique_lock<std::mutex> guard(m_lock);
+                m_done.wait(guard,[this]() {
+                    return m_pending==0;
+                });
+                for(size_t i = 1;i<count;++i) {
+                    if(leader(i)==i) {
+                        result = combine(result,m_results[i]);
+                    }
+                }
+                return result;
+            }
+#endif
+            return flush_bus(0);
+        }
+        // GFX Bindings
+        using type = ssd1306_tiled;
+        using pixel_type = typename first_type::pixel_type;
+        using caps = gfx::gfx_caps<false,false,false,false,true,true,false>;
+        inline gfx::size16 dimensions() const {
+            const gfx::size16 ts = tile_size();
+            return gfx::size16(ts.width*Columns,ts.height*Rows);
+        }
+        inline gfx::rect16 bounds() const {
+            return dimensions().bounds();
+        }
+        gfx::gfx_result point(gfx::point16 location,pixel_type* out_color) const {
+            const gfx::size16 ts = tile_size();
+            if(location.x>=ts.width*Columns || location.y>=ts.height*Rows) {
+                return gfx::gfx_result::invalid_argument;
+            }
+            const gfx::spoint16 pt(location.x,location.y);
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                if(tb.intersects(pt)) {
+                    result = tile.point(gfx::point16(pt.x-tb.x1,pt.y-tb.y1),out_color);
+                }
+            };
+            const_cast<ssd1306_tiled*>(this)->for_each(fn);
+            return result;
+        }
+        gfx::gfx_result point(gfx::point16 location,pixel_type color) {
+            const gfx::spoint16 pt(location.x,location.y);
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                if(tb.intersects(pt)) {
+                    result = tile.point(gfx::point16(pt.x-tb.x1,pt.y-tb.y1),color);
+                }
+            };
+            for_each(fn);
+            return result;
+        }
+        gfx::gfx_result fill(const gfx::rect16& bounds,pixel_type color) {
+            const gfx::srect16 rect = ((gfx::srect16)bounds).normalize();
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                if(tb.intersects(rect)) {
+                    const gfx::srect16 r = rect.crop(tb).offset(-tb.x1,-tb.y1);
+                    result = combine(result,tile.fill((gfx::rect16)r,color));
+                }
+            };
+            for_each(fn);
+            return result;
+        }
+        inline gfx::gfx_result clear(const gfx::rect16& rect) {
+            pixel_type p;
+            return fill(rect,p);
+        }
+        gfx::gfx_result line(const gfx::srect16& endpoints,pixel_type color) {
+            const gfx::srect16 extent = endpoints.normalize();
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                if(tb.intersects(extent)) {
+                    result = combine(result,tile.line(endpoints.offset(-tb.x1,-tb.y1),color));
+                }
+            };
+            for_each(fn);
+            return result;
+        }
+        gfx::gfx_result ellipse(const gfx::srect16& rect,pixel_type color) {
+            const gfx::srect16 extent = rect.normalize();
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                if(tb.intersects(extent)) {
+                    result = combine(result,tile.ellipse(rect.offset(-tb.x1,-tb.y1),color));
+                }
+            };
+            for_each(fn);
+            return result;
+        }
+        gfx::gfx_result filled_ellipse(const gfx::srect16& rect,pixel_type color) {
+            const gfx::srect16 extent = rect.normalize();
+            gfx::gfx_result result = gfx::gfx_result::success;
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                if(tb.intersects(extent)) {
+                    result = combine(result,tile.filled_ellipse(rect.offset(-tb.x1,-tb.y1),color));
+                }
+            };
+            for_each(fn);
+            return result;
+        }
+        gfx::gfx_result suspend() {
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                (void)tb;
+                tile.suspend();
+            };
+            for_each(fn);
+            return gfx::gfx_result::success;
+        }
+        gfx::gfx_result resume(bool force=false) {
+            auto fn = [&](auto& tile,const gfx::srect16& tb) {
+                (void)tb;
+                tile.resume(force);
+            };
+            for_each(fn);
+            return gfx::gfx_result::success;
+        }
+    };
+}
+#endif // HTCW_SSD1306_TILED_HPP
@@ -0,0 +1,526 @@
+// converts images to ssd1306_image headers in the panel's page format,
+// or a series of frames to an ssd1306_animation delta stream
+// build with: c++ -std=c++14 -O2 ssd1306_convert.cpp -o ssd1306_convert
+// reads PBM/PGM/PPM (P1-P6). If stb_image.h is on the include path, PNG,
+// JPEG, BMP and GIF are read too
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#if defined(__has_include)
+#if __has_include("stb_image.h")
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define SSD1306_CONVERT_STB
+#endif
+#endif
+
+enum struct dither_mode {
+    threshold = 0,
+    bayer,
+    floyd
+};
+struct options {
+    std::vector<const char*> inputs;
+    const char* output = nullptr;
+    bool animation = false;
+    int delay = 33;
+    std::string name;
+    dither_mode dither = dither_mode::floyd;
+    int threshold = 128;
+    int rotation = 0;
+    int width = 0;
+    int height = 0;
+    bool rle = false;
+    bool invert = false;
+};
+// an 8-bit grayscale image
+struct gray_image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> data;
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: ssd1306_convert [options] <input> [output.h]\n"
+        "       ssd1306_convert -a [options] -o <output.h|output.bin> <frame> <frame>...\n"
+        "  -a             encode the inputs as animation frames\n"
+        "  -f <ms>        the delay between animation frames (default: 33)\n"
+        "  -o <output>    the output file. .bin writes the raw animation stream\n"
+        "  -n <name>      the C identifier to emit (default: from the input file name)\n"
+        "  -d <dither>    none, bayer or floyd (default: floyd)\n"
+        "  -t <level>     the threshold for -d none, 0-255 (default: 128)\n"
+        "  -r <rotation>  the display rotation to lay the pages out for, 0-3 (default: 0)\n"
+        "  -s <w>x<h>     crop to w x h around the center\n"
+        "  -c             run length encode the pages\n"
+        "  -i             invert\n");
+}
+// reads an unsigned decimal from a netpbm header, skipping comments
+static bool read_pnm_int(FILE* f,int* out) {
+    int ch = fgetc(f);
+    while(ch!=EOF) {
+        if(ch=='#') {
+            while(ch!=EOF && ch!='\n') {
+                ch = fgetc(f);
+            }
+        } else if(!isspace(ch)) {
+            break;
+        }
+        ch = fgetc(f);
+    }
+    if(ch==EOF || !isdigit(ch)) {
+        return false;
+    }
+    int v = 0;
+    while(ch!=EOF && isdigit(ch)) {
+        v = v*10+(ch-'0');
+        ch = fgetc(f);
+    }
+    *out = v;
+    return true;
+}
+static bool load_pnm(const char* path,gray_image* out) {
+    FILE* f = fopen(path,"rb");
+    if(f==nullptr) {
+        return false;
+    }
+    int kind = 0;
+    if(fgetc(f)!='P' || (kind = fgetc(f)-'0')<1 || kind>6) {
+        fclose(f);
+        return false;
+    }
+    int w, h, maxval = 1;
+    if(!read_pnm_int(f,&w) || !read_pnm_int(f,&h) || ((kind!=1 && kind!=4) && !read_pnm_int(f,&maxval)) || w<1 || h<1 || maxval<1) {
+        fclose(f);
+        return false;
+    }
+    out->width = w;
+    out->height = h;
+    out->data.assign(size_t(w)*h,0);
+    const bool binary = kind>3;
+    const int channels = (kind==3 || kind==6)?3:1;
+    const bool wide = maxval>255;
+    for(int y = 0;y<h;++y) {
+        int bits = 0, bit_count = 0;
+        for(int x = 0;x<w;++x) {
+            int sum = 0;
+            for(int c = 0;c<channels;++c) {
+                int v;
+                if(kind==4) {
+                    if(!bit_count) {
+                        bits = fgetc(f);
+                        bit_count = 8;
+                    }
+                    v = (bits>>--bit_count)&1;
+                } else if(binary) {
+                    v = fgetc(f);
+                    if(wide) {
+                        v = (v<<8)|fgetc(f);
+                    }
+                } else if(!read_pnm_int(f,&v)) {
+                    fclose(f);
+                    return false;
+                }
+                if(v<0) {
+                    fclose(f);
+                    return false;
+                }
+                sum+=v;
+            }
+            int v = sum/channels;
+            // in PBM 1 is black
+            v = (kind==1 || kind==4)?(v?0:255):v*255/maxval;
+            out->data[size_t(y)*w+x] = uint8_t(v);
+        }
+    }
+    fclose(f);
+    return true;
+}
+static bool load_image(const char* path,gray_image* out) {
+    if(load_pnm(path,out)) {
+        return true;
+    }
+#ifdef SSD1306_CONVERT_STB
+    int w, h, n;
+    unsigned char* px = stbi_load(path,&w,&h,&n,1);
+    if(px!=nullptr) {
+        out->width = w;
+        out->height = h;
+        out->data.assign(px,px+size_t(w)*h);
+        stbi_image_free(px);
+        return true;
+    }
+#endif
+    return false;
+}
+static void crop(gray_image& img,int w,int h) {
+    gray_image result;
+    result.width = w;
+    result.height = h;
+    result.data.assign(size_t(w)*h,0);
+    const int ox = (img.width-w)/2, oy = (img.height-h)/2;
+    for(int y = 0;y<h;++y) {
+        for(int x = 0;x<w;++x) {
+            const int sx = x+ox, sy = y+oy;
+            if(sx>=0 && sy>=0 && sx<img.width && sy<img.height) {
+                result.data[size_t(y)*w+x] = img.data[size_t(sy)*img.width+sx];
+            }
+        }
+    }
+    img = result;
+}
+// reduces the image to 0 or 255 per pixel
+static void dither(gray_image& img,dither_mode mode,int threshold) {
+    static const uint8_t bayer[4][4] = {{0,8,2,10},{12,4,14,6},{3,11,1,9},{15,7,13,5}};
+    const int w = img.width, h = img.height;
+    std::vector<int> err;
+    if(mode==dither_mode::floyd) {
+        err.assign(img.data.begin(),img.data.end());
+    }
+    for(int y = 0;y<h;++y) {
+        for(int x = 0;x<w;++x) {
+            const size_t i = size_t(y)*w+x;
+            bool on;
+            switch(mode) {
+                case dither_mode::bayer:
+                    on = img.data[i]*16>(bayer[y&3][x&3]*2+1)*128;
+                    break;
+                case dither_mode::floyd: {
+                    const int v = err[i];
+                    on = v>=128;
+                    const int e = v-(on?255:0);
+                    if(x+1<w) err[i+1]+=e*7/16;
+                    if(y+1<h) {
+                        if(x>0) err[i+w-1]+=e*3/16;
+                        err[i+w]+=e*5/16;
+                        if(x+1<w) err[i+w+1]+=e/16;
+                    }
+                    break;
+                }
+                default:
+                    on = img.data[i]>=threshold;
+                    break;
+            }
+            img.data[i] = on?255:0;
+        }
+    }
+}
+// lays a 1-bit image out in page format for a display rotation
+static std::vector<uint8_t> to_pages(const gray_image& img,int rotation) {
+    const bool odd = rotation&1;
+    const int nw = odd?img.height:img.width;
+    const int nh = odd?img.width:img.height;
+    std::vector<uint8_t> result(size_t(nw)*((nh+7)/8),0);
+    for(int y = 0;y<img.height;++y) {
+        for(int x = 0;x<img.width;++x) {
+            if(!img.data[size_t(y)*img.width+x]) {
+                continue;
+            }
+            int nx, ny;
+            switch(rotation) {
+                case 1:
+                    nx = y; ny = nh-1-x;
+                    break;
+                case 2:
+                    nx = nw-1-x; ny = nh-1-y;
+                    break;
+                case 3:
+                    nx = nw-1-y; ny = x;
+                    break;
+                default:
+                    nx = x; ny = y;
+                    break;
+            }
+            result[size_t(ny/8)*nw+nx]|=uint8_t(1<<(ny&7));
+        }
+    }
+    return result;
+}
+// run length encodes in the format ssd1306_image::flag_rle describes
+static std::vector<uint8_t> rle_encode(const std::vector<uint8_t>& in) {
+    std::vector<uint8_t> result;
+    size_t i = 0;
+    while(i<in.size()) {
+        size_t run = 1;
+        while(i+run<in.size() && in[i+run]==in[i] && run<129) {
+            ++run;
+        }
+        if(run>=2) {
+            result.push_back(uint8_t(0x80|(run-2)));
+            result.push_back(in[i]);
+            i+=run;
+            continue;
+        }
+        const size_t start = i;
+        while(i<in.size() && i-start<128 && !(i+1<in.size() && in[i+1]==in[i])) {
+            ++i;
+        }
+        result.push_back(uint8_t(i-start-1));
+        result.insert(result.end(),in.begin()+start,in.begin()+i);
+    }
+    return result;
+}
+// makes a C identifier from the file name, without its extension
+static std::string identifier(const char* path) {
+    const char* sz = strrchr(path,'/');
+    sz = sz==nullptr?path:sz+1;
+    const char* end = strrchr(sz,'.');
+    if(end==nullptr || end==sz) {
+        end = sz+strlen(sz);
+    }
+    std::string result;
+    for(;sz<end;++sz) {
+        result+=isalnum((unsigned char)*sz)?*sz:'_';
+    }
+    if(result.empty() || isdigit((unsigned char)result[0])) {
+        result = "_"+result;
+    }
+    return result;
+}
+static void write_bytes(FILE* f,const std::vector<uint8_t>& data) {
+    for(size_t i = 0;i<data.size();++i) {
+        if(!(i%16)) {
+            fputs(i?",\n\t":"\t",f);
+        } else {
+            fputs(", ",f);
+        }
+        fprintf(f,"0x%02X",data[i]);
+    }
+    fputs("\n",f);
+}
+static void write_header(FILE* f,const options& opts,const gray_image& img,const std::vector<uint8_t>& data) {
+    const char* n = opts.name.c_str();
+    fprintf(f,"#ifndef %s_HPP\n#define %s_HPP\n#include <stdint.h>\n#include <ssd1306.hpp>\n",n,n);
+    fprintf(f,"#ifndef PROGMEM\n\t#define PROGMEM\n#endif\n");
+    fprintf(f,"static const uint8_t %s_data[] PROGMEM = {\n",n);
+    write_bytes(f,data);
+    fprintf(f,"};\n");
+    fprintf(f,"static const ::arduino::ssd1306_image %s = {%d,%d,%s,%d,%s_data};\n",n,img.width,img.height,opts.rle?"::arduino::ssd1306_image::flag_rle":"0",opts.rotation,n);
+    fprintf(f,"#endif // %s_HPP\n",n);
+}
+// encodes the XOR of two frames' pages as the runs ssd1306_animation
+// reads. Gaps shorter than a run header are folded into the run
+static void encode_delta(const std::vector<uint8_t>& prev,const std::vector<uint8_t>& cur,int page_width,std::vector<uint8_t>& out) {
+    const int pages = int(cur.size())/page_width;
+    for(int page = 0;page<pages;++page) {
+        const uint8_t* a = prev.data()+size_t(page)*page_width;
+        const uint8_t* b = cur.data()+size_t(page)*page_width;
+        int x = 0;
+        while(x<page_width) {
+            if(a[x]==b[x]) {
+                ++x;
+                continue;
+            }
+            int end = x+1;
+            int last = x;
+            while(end<page_width && end-x<255) {
+                if(a[end]!=b[end]) {
+                    last = end;
+                } else if(end-last>3) {
+                    break;
+                }
+                ++end;
+            }
+            out.push_back(uint8_t(page));
+            out.push_back(uint8_t(x));
+            out.push_back(uint8_t(last-x+1));
+            for(int i = x;i<=last;++i) {
+                out.push_back(a[i]^b[i]);
+            }
+            x = last+1;
+        }
+    }
+    out.push_back(0xFF);
+}
+static void push16(std::vector<uint8_t>& out,int value) {
+    out.push_back(uint8_t(value&0xFF));
+    out.push_back(uint8_t((value>>8)&0xFF));
+}
+static bool ends_with(const char* sz,const char* suffix) {
+    const size_t l = strlen(sz), sl = strlen(suffix);
+    return l>=sl && !strcmp(sz+l-sl,suffix);
+}
+// loads and reduces an input to 1-bit per the options
+static bool prepare(const char* path,const options& opts,gray_image* out) {
+    if(!load_image(path,out)) {
+        fprintf(stderr,"could not read %s\n",path);
+        return false;
+    }
+    if(opts.width) {
+        crop(*out,opts.width,opts.height);
+    }
+    if(opts.invert) {
+        for(uint8_t& v : out->data) {
+            v = 255-v;
+        }
+    }
+    dither(*out,opts.dither,opts.threshold);
+    return true;
+}
+static int convert_animation(const options& opts) {
+    if(opts.output==nullptr) {
+        usage();
+        return 1;
+    }
+    std::vector<uint8_t> stream = {'S','A'};
+    std::vector<uint8_t> prev;
+    int w = 0, h = 0;
+    for(const char* path : opts.inputs) {
+        gray_image img;
+        if(!prepare(path,opts,&img)) {
+            return 1;
+        }
+        if(prev.empty()) {
+            w = img.width;
+            h = img.height;
+            const int page_width = (opts.rotation&1)?h:w;
+            if(page_width>255) {
+                fprintf(stderr,"frames must be at most 255 pixels across the pages\n");
+                return 1;
+            }
+            push16(stream,w);
+            push16(stream,h);
+            stream.push_back(uint8_t(opts.rotation));
+            push16(stream,int(opts.inputs.size()));
+            push16(stream,opts.delay);
+        } else if(img.width!=w || img.height!=h) {
+            fprintf(stderr,"%s is not the size of the first frame\n",path);
+            return 1;
+        }
+        std::vector<uint8_t> cur = to_pages(img,opts.rotation);
+        if(prev.empty()) {
+            prev.assign(cur.size(),0);
+        }
+        encode_delta(prev,cur,(opts.rotation&1)?h:w,stream);
+        prev = cur;
+    }
+    FILE* f = fopen(opts.output,ends_with(opts.output,".bin")?"wb":"w");
+    if(f==nullptr) {
+        fprintf(stderr,"could not write %s\n",opts.output);
+        return 1;
+    }
+    if(ends_with(opts.output,".bin")) {
+        fwrite(stream.data(),1,stream.size(),f);
+    } else {
+        const char* n = opts.name.c_str();
+        fprintf(f,"#ifndef %s_HPP\n#define %s_HPP\n#include <stdint.h>\n",n,n);
+        fprintf(f,"#ifndef PROGMEM\n\t#define PROGMEM\n#endif\n");
+        fprintf(f,"static const uint8_t %s[] PROGMEM = {\n",n);
+        write_bytes(f,stream);
+        fprintf(f,"};\n#endif // %s_HPP\n",n);
+    }
+    fclose(f);
+    return 0;
+}
+static bool parse_args(int argc,char** argv,options* out) {
+    for(int i = 1;i<argc;++i) {
+        const char* a = argv[i];
+        if(a[0]=='-' && a[1] && !a[2]) {
+            const char opt = a[1];
+            if(opt=='c') {
+                out->rle = true;
+                continue;
+            }
+            if(opt=='i') {
+                out->invert = true;
+                continue;
+            }
+            if(opt=='a') {
+                out->animation = true;
+                continue;
+            }
+            if(i+1>=argc) {
+                return false;
+            }
+            const char* v = argv[++i];
+            switch(opt) {
+                case 'n':
+                    out->name = v;
+                    break;
+                case 'o':
+                    out->output = v;
+                    break;
+                case 'f':
+                    out->delay = atoi(v);
+                    if(out->delay<0 || out->delay>0xFFFF) {
+                        return false;
+                    }
+                    break;
+                case 'd':
+                    if(!strcmp(v,"none")) {
+                        out->dither = dither_mode::threshold;
+                    } else if(!strcmp(v,"bayer")) {
+                        out->dither = dither_mode::bayer;
+                    } else if(!strcmp(v,"floyd")) {
+                        out->dither = dither_mode::floyd;
+                    } else {
+                        return false;
+                    }
+                    break;
+                case 't':
+                    out->threshold = atoi(v);
+                    break;
+                case 'r':
+                    out->rotation = atoi(v);
+                    if(out->rotation<0 || out->rotation>3) {
+                        return false;
+                    }
+                    break;
+                case 's':
+                    if(2!=sscanf(v,"%dx%d",&out->width,&out->height) || out->width<1 || out->height<1) {
+                        return false;
+                    }
+                    break;
+                default:
+                    return false;
+            }
+        } else {
+            out->inputs.push_back(a);
+        }
+    }
+    if(!out->animation && out->inputs.size()==2 && out->output==nullptr) {
+        out->output = out->inputs.back();
+        out->inputs.pop_back();
+    }
+    return !out->inputs.empty() && (out->animation || out->inputs.size()==1);
+}
+int main(int argc,char** argv) {
+    options opts;
+    if(!parse_args(argc,argv,&opts)) {
+        usage();
+        return 1;
+    }
+    if(opts.name.empty()) {
+        opts.name = identifier(opts.inputs[0]);
+    }
+    if(opts.animation) {
+        return convert_animation(opts);
+    }
+    gray_image img;
+    if(!prepare(opts.inputs[0],opts,&img)) {
+        return 1;
+    }
+    std::vector<uint8_t> data = to_pages(img,opts.rotation);
+    if(opts.rle) {
+        std::vector<uint8_t> packed = rle_encode(data);
+        if(packed.size()<data.size()) {
+            data = packed;
+        } else {
+            opts.rle = false;
+        }
+    }
+    FILE* f = stdout;
+    if(opts.output!=nullptr && (f = fopen(opts.output,"w"))==nullptr) {
+        fprintf(stderr,"could not write %s\n",opts.output);
+        return 1;
+    }
+    write_header(f,opts,img,data);
+    if(f!=stdout) {
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+// interleaves drawing with initialize_async() and flush_async() on the
+// host panel, to check the init sequence goes out exactly once and the
+// panel ends up holding the frame buffer. Build it with htcw_gfx on the
+// include path:
+//   c++ -std=c++14 -O1 -g -I../ssd1306_shared_stress/host -I../../include
+//       -I<htcw_gfx>/src ssd1306_async_init.cpp -o ssd1306_async_init
+// It exits with 0 when every check passes
+#include <stdio.h>
+#include <tft_driver.hpp>
+#include <ssd1306.hpp>
+using namespace arduino;
+// a reset pin, so the async init waits out the reset pulse
+using lcd_type = ssd1306<128,64,host_bus,0,1,0x3C,true,400,-1,4,true>;
+static int failures = 0;
+static void fail(const char* message) {
+    fprintf(stderr,"FAIL: %s\n",message);
+    ++failures;
+}
+// whether the panel shows what the frame buffer holds
+static bool matches(const lcd_type& lcd) {
+    const host_panel& panel = host_panel::at(0x3C);
+    for(int y = 0;y<64;++y) {
+        for(int x = 0;x<128;++x) {
+            lcd_type::pixel_type px;
+            lcd.point(gfx::point16(x,y),&px);
+            if(((panel.gddram[y>>3][x]>>(y&7))&1)!=px.native_value) {
+                fprintf(stderr,"pixel (%d, %d) differs\n",x,y);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+static void scribble(lcd_type& lcd,unsigned& seed) {
+    seed = seed*1103515245+12345;
+    lcd_type::pixel_type px;
+    px.native_value = (seed>>16)&1;
+    const int x = (seed>>8)&127, y = (seed>>20)&63;
+    if((seed>>30)&1) {
+        lcd.point(gfx::point16(x,y),px);
+    } else {
+        lcd.fill(gfx::rect16(x,y,x+((seed>>4)&15),y+((seed>>12)&7)),px);
+    }
+}
+int main() {
+    static lcd_type lcd;
+    host_panel& panel = host_panel::at(0x3C);
+    lcd_type::pixel_type white;
+    white.native_value = 1;
+    lcd_type::future init = lcd.initialize_async();
+    if(init.done()) {
+        fail("the async init finished without waiting out the reset");
+    }
+    // nothing may start a second init while the first is pending
+    size_t polls = 0;
+    while(!init.done()) {
+        if(lcd.initialize()!=gfx::gfx_result::invalid_state) {
+            fail("initialize() ran during an async init");
+        }
+        if(lcd.point(gfx::point16(0,0),white)!=gfx::gfx_result::invalid_state) {
+            fail("point() initialized during an async init");
+        }
+        if(lcd.initialize_async().result()!=gfx::gfx_result::invalid_state) {
+            fail("a second async init was started");
+        }
+        if(lcd.flush_async().result()!=gfx::gfx_result::invalid_state) {
+            fail("a flush was started during an async init");
+        }
+        if(panel.display_ons!=0) {
+            fail("the init sequence was sent during the reset pulse");
+        }
+        init.poll();
+        ++polls;
+    }
+    if(init.result()!=gfx::gfx_result::success || !lcd.initialized()) {
+        fail("the async init failed");
+    }
+    for(int i = 0;i<16;++i) {
+        lcd.poll();
+    }
+    if(lcd.initialize()!=gfx::gfx_result::success) {
+        fail("initialize() failed once initialized");
+    }
+    if(panel.display_ons!=1) {
+        fprintf(stderr,"the init sequence was sent %d times\n",(int)panel.display_ons);
+        fail("init count");
+    }
+    // draw while flushes are in flight, in both update modes
+    unsigned seed = 1;
+    size_t flushes = 0;
+    const ssd1306_update_mode modes[] = {ssd1306_update_mode::manual,ssd1306_update_mode::immediate};
+    for(ssd1306_update_mode mode : modes) {
+        lcd.update_mode(mode);
+        for(int round = 0;round<64;++round) {
+            for(int i = 0;i<8;++i) {
+                scribble(lcd,seed);
+            }
+            lcd_type::future flush = lcd.flush_async();
+            if(flush.done()) {
+                // nothing was dirty
+                continue;
+            }
+            ++flushes;
+            int drawn = 0;
+            while(!flush.poll()) {
+                if(lcd.flush_async().result()!=gfx::gfx_result::invalid_state) {
+                    fail("a second flush was started");
+                }
+                // stop drawing eventually, so the flush catches up
+                if(drawn++<4) {
+                    scribble(lcd,seed);
+                }
+            }
+            if(flush.result()!=gfx::gfx_result::success) {
+                fail("the async flush failed");
+            }
+            if(lcd.dirty()) {
+                fail("damage left after an async flush");
+            }
+            if(!matches(lcd)) {
+                fail("panel contents");
+                break;
+            }
+        }
+    }
+    if(panel.display_ons!=1) {
+        fail("the init sequence was sent again");
+    }
+    if(failures) {
+        return 1;
+    }
+    printf("OK: init over %d polls, %d async flushes\n",(int)polls,(int)flushes);
+    return 0;
+}
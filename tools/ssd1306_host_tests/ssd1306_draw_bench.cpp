@@ -0,0 +1,134 @@
+// times the driver's line(), ellipse() and filled_ellipse() against the
+// same shapes plotted the way GFX's draw::line() and draw::ellipse()
+// plot them on a target without a faster path: point() for each pixel,
+// and fill() for each row of a filled ellipse. Build it with htcw_gfx on
+// the include path:
+//   c++ -std=c++14 -O2 -I../ssd1306_shared_stress/host -I../../include
+//       -I<htcw_gfx>/src ssd1306_draw_bench.cpp -o ssd1306_draw_bench
+// It prints the microseconds and the bytes sent per shape for each update
+// mode, counting 6 bytes of addressing per window. The host bus is
+// instant, so on a panel the bytes dominate
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <tft_driver.hpp>
+#include <ssd1306.hpp>
+using namespace arduino;
+template<typename Display>
+static void line_points(Display& lcd,int x1,int y1,int x2,int y2,typename Display::pixel_type color) {
+    const int dx = abs(x2-x1), dy = -abs(y2-y1);
+    const int sx = x1<x2?1:-1, sy = y1<y2?1:-1;
+    int err = dx+dy;
+    while(true) {
+        lcd.point(gfx::point16(x1,y1),color);
+        if(x1==x2 && y1==y2) {
+            break;
+        }
+        const int e2 = 2*err;
+        if(e2>=dy) {
+            err+=dy;
+            x1+=sx;
+        }
+        if(e2<=dx) {
+            err+=dx;
+            y1+=sy;
+        }
+    }
+}
+// the midpoint ellipse inscribed in the square at (x,y) with sides of
+// 2r+1, plotted with point(), or with a fill() per row when filled
+template<typename Display>
+static void circle_points(Display& lcd,int cx,int cy,int r,typename Display::pixel_type color,bool filled) {
+    int x = r, y = 0, err = 1-r;
+    while(x>=y) {
+        if(filled) {
+            lcd.fill(gfx::rect16(cx-x,cy+y,cx+x,cy+y),color);
+            lcd.fill(gfx::rect16(cx-x,cy-y,cx+x,cy-y),color);
+            lcd.fill(gfx::rect16(cx-y,cy+x,cx+y,cy+x),color);
+            lcd.fill(gfx::rect16(cx-y,cy-x,cx+y,cy-x),color);
+        } else {
+            const int px[] = {x,y,-y,-x,-x,-y,y,x};
+            const int py[] = {y,x,x,y,-y,-x,-x,-y};
+            for(int i = 0;i<8;++i) {
+                lcd.point(gfx::point16(cx+px[i],cy+py[i]),color);
+            }
+        }
+        ++y;
+        if(err<0) {
+            err+=2*y+1;
+        } else {
+            --x;
+            err+=2*(y-x)+1;
+        }
+    }
+}
+// the command bytes addressing each window takes
+constexpr static const size_t window_overhead = 6;
+struct result {
+    double us;
+    double bytes;
+};
+template<typename Display,typename Function>
+static result measure(Function fn,int count) {
+    using namespace std::chrono;
+    host_panel& panel = host_panel::at(Display::address);
+    panel.windows.clear();
+    const size_t bytes = panel.data_bytes;
+    const steady_clock::time_point start = steady_clock::now();
+    for(int i = 0;i<count;++i) {
+        fn(i);
+    }
+    const double us = duration_cast<nanoseconds>(steady_clock::now()-start).count()/1000.0;
+    const size_t sent = panel.data_bytes-bytes+panel.windows.size()*window_overhead;
+    return result{us/count,double(sent)/count};
+}
+static void print(const char* shape,const result& member,const result& points) {
+    printf("  %-8s %8.2fus %7.1fB   vs %8.2fus %7.1fB\n",shape,member.us,member.bytes,points.us,points.bytes);
+}
+template<typename Display>
+static void bench(const char* name) {
+    static Display lcd;
+    lcd.initialize();
+    typename Display::pixel_type color;
+    const ssd1306_update_mode modes[] = {ssd1306_update_mode::manual,ssd1306_update_mode::immediate};
+    const char* mode_names[] = {"manual","immediate"};
+    const int count = 2000;
+    for(int m = 0;m<2;++m) {
+        lcd.update_mode(modes[m]);
+        const result line = measure<Display>([&](int i) {
+            color.native_value = i&1;
+            lcd.line(gfx::srect16(i%16,0,127-i%16,63),color);
+        },count);
+        const result line_p = measure<Display>([&](int i) {
+            color.native_value = i&1;
+            line_points(lcd,i%16,0,127-i%16,63,color);
+        },count);
+        const result ellipse = measure<Display>([&](int i) {
+            color.native_value = i&1;
+            lcd.ellipse(gfx::srect16(34,2,94,62),color);
+        },count);
+        const result ellipse_p = measure<Display>([&](int i) {
+            color.native_value = i&1;
+            circle_points(lcd,64,32,30,color,false);
+        },count);
+        const result filled = measure<Display>([&](int i) {
+            color.native_value = i&1;
+            lcd.filled_ellipse(gfx::srect16(34,2,94,62),color);
+        },count);
+        const result filled_p = measure<Display>([&](int i) {
+            color.native_value = i&1;
+            circle_points(lcd,64,32,30,color,true);
+        },count);
+        lcd.flush();
+        printf("%s, %s:\n",name,mode_names[m]);
+        print("line",line,line_p);
+        print("ellipse",ellipse,ellipse_p);
+        print("filled",filled,filled_p);
+    }
+}
+int main() {
+    printf("per shape, member call vs point()/fill()\n");
+    bench<ssd1306<128,64,host_bus,0,1,0x3C>>("1-bit");
+    bench<ssd1306<128,64,host_bus,0,4,0x3D>>("4-bit");
+    return 0;
+}
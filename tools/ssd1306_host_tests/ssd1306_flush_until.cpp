@@ -0,0 +1,70 @@
+// times flush_until() against deadlines on a host panel whose bus takes
+// a fixed time per byte, to check it stops before a chunk would run past
+// the deadline. Build it with htcw_gfx on the include path:
+//   c++ -std=c++14 -O2 -I../ssd1306_shared_stress/host -I../../include
+//       -I<htcw_gfx>/src ssd1306_flush_until.cpp -o ssd1306_flush_until
+// It exits with 0 when every check passes
+#include <stdio.h>
+#include <tft_driver.hpp>
+#include <ssd1306.hpp>
+using namespace arduino;
+using lcd_type = ssd1306<128,64,host_bus>;
+static int failures = 0;
+static void fail(const char* message) {
+    fprintf(stderr,"FAIL: %s\n",message);
+    ++failures;
+}
+int main() {
+    static lcd_type lcd;
+    if(lcd.initialize()!=gfx::gfx_result::success) {
+        fail("initialize");
+        return 1;
+    }
+    lcd.update_mode(ssd1306_update_mode::manual);
+    lcd_type::pixel_type white;
+    white.native_value = 1;
+    // 2.5us a byte, about I2C at 3.6MHz
+    host_panel::byte_time() = 2500;
+    // slots from shorter than one window to several chunks
+    const uint32_t slots[] = {10,40,100,250,1000};
+    // the host may preempt us mid chunk, so a few calls may be late
+    const int32_t tolerance = 40;
+    size_t calls = 0, sends = 0, late_sends = 0;
+    for(uint32_t slot : slots) {
+        lcd.fill(gfx::rect16(0,0,127,63),white);
+        size_t stalls = 0;
+        while(lcd.dirty()) {
+            const size_t before = host_panel::at(0x3C).data_bytes;
+            const uint32_t deadline = micros()+slot;
+            lcd.flush_until(deadline);
+            const int32_t late = int32_t(micros()-deadline);
+            if(host_panel::at(0x3C).data_bytes==before) {
+                // a slot too short for one window never sends anything
+                if(++stalls>100000) {
+                    break;
+                }
+                continue;
+            }
+            // the first chunk ever measures the bus
+            if(calls++>0) {
+                ++sends;
+                if(late>tolerance) {
+                    ++late_sends;
+                }
+            }
+        }
+        if(slot>=100 && lcd.dirty()) {
+            fail("a slot with room for a window sent nothing");
+        }
+        lcd.flush();
+    }
+    if(late_sends*100>sends) {
+        fprintf(stderr,"%d of %d calls returned over %dus late\n",(int)late_sends,(int)sends,(int)tolerance);
+        fail("deadline overrun");
+    }
+    if(failures) {
+        return 1;
+    }
+    printf("OK: %d calls sent data, %d of them over %dus late\n",(int)sends,(int)late_sends,(int)tolerance);
+    return 0;
+}
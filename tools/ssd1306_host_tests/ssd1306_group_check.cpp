@@ -0,0 +1,167 @@
+// flushes two panels at 0x3C and 0x3D through ssd1306_group, tracing the
+// address of every transfer, to check the schedules' order, mirror mode,
+// that on_select() comes before each panel's traffic and that a panel in
+// temporal mode is left alone. Build it with htcw_gfx on the include
+// path:
+//   c++ -std=c++14 -O1 -g -I../ssd1306_shared_stress/host -I../../include
+//       -I<htcw_gfx>/src ssd1306_group_check.cpp -o ssd1306_group_check
+// It exits with 0 when every check passes
+#include <stdio.h>
+#include <tft_driver.hpp>
+#include <ssd1306_group.hpp>
+using namespace arduino;
+using first_type = ssd1306<128,64,host_bus,0,4,0x3C>;
+using second_type = ssd1306<128,64,host_bus,0,4,0x3D>;
+using group_type = ssd1306_group<first_type,second_type>;
+static int failures = 0;
+static void fail(const char* message) {
+    fprintf(stderr,"FAIL: %s\n",message);
+    ++failures;
+}
+constexpr static const uint8_t addresses[] = {0x3C,0x3D};
+// on_select() leaves a negative marker in the trace: -1 for the first
+// panel, -2 for the second
+static void on_select(size_t index,void* state) {
+    (void)state;
+    host_panel::trace().push_back(-1-int(index));
+}
+// the panel each on_select() picked, in order. Fails unless every
+// transfer went to the panel selected last
+static std::vector<int> selections(const char* name) {
+    std::vector<int> result;
+    int selected = -1;
+    for(int entry : host_panel::trace()) {
+        if(entry<0) {
+            selected = -1-entry;
+            result.push_back(selected);
+        } else if(selected==-1 || entry!=addresses[selected]) {
+            fprintf(stderr,"%s: a transfer to 0x%02X with panel %d selected\n",name,entry,selected);
+            fail("traffic without on_select()");
+            break;
+        }
+    }
+    return result;
+}
+// damages 4 pages of each panel with different content
+static void scribble(first_type& first,second_type& second) {
+    first_type::pixel_type px;
+    px.native_value = 15;
+    first.fill(gfx::rect16(0,0,63,31),px);
+    second_type::pixel_type px2;
+    px2.native_value = 9;
+    second.fill(gfx::rect16(32,8,127,39),px2);
+}
+static void start_trace() {
+    host_panel::trace().clear();
+    host_panel::tracing() = true;
+}
+int main() {
+    static first_type first;
+    static second_type second;
+    group_type group(first,second);
+    group.on_select(on_select);
+    if(group.initialize()!=gfx::gfx_result::success) {
+        fail("initialize");
+        return 1;
+    }
+    first.update_mode(ssd1306_update_mode::manual);
+    second.update_mode(ssd1306_update_mode::manual);
+    first.dithering(false);
+    second.dithering(false);
+    host_panel& a = host_panel::at(0x3C);
+    host_panel& b = host_panel::at(0x3D);
+
+    // round robin: every two spans, one from each panel
+    scribble(first,second);
+    start_trace();
+    group.flush();
+    std::vector<int> order = selections("round robin");
+    if(order.size()!=8) {
+        fprintf(stderr,"round robin sent %d spans\n",(int)order.size());
+        fail("span count");
+    }
+    for(size_t i = 0;i+1<order.size();i+=2) {
+        if(order[i]==order[i+1]) {
+            fail("round robin sent one panel twice in a round");
+            break;
+        }
+    }
+    if(first.dirty() || second.dirty()) {
+        fail("damage left after a round robin flush");
+    }
+
+    // priority: the first panel is drained before the second
+    group.schedule(ssd1306_schedule::priority);
+    scribble(first,second);
+    start_trace();
+    group.flush();
+    order = selections("priority");
+    const std::vector<int> drained = {0,0,0,0,1,1,1,1};
+    if(order!=drained) {
+        fail("priority didn't drain the panels in order");
+    }
+
+    // mirror: both panels get the first panel's frame buffer. It only
+    // sends damage, so damage the whole screen
+    group.mirror(true);
+    first.fill(gfx::rect16(0,0,127,63),first_type::pixel_type());
+    first_type::pixel_type px;
+    px.native_value = 12;
+    first.fill(gfx::rect16(10,20,100,50),px);
+    start_trace();
+    group.flush();
+    order = selections("mirror");
+    for(size_t i = 0;i<order.size();++i) {
+        if(order[i]!=int(i&1)) {
+            fail("mirror didn't send each span to both panels in turn");
+            break;
+        }
+    }
+    if(memcmp(a.gddram,b.gddram,sizeof(a.gddram))!=0) {
+        fail("mirrored panels differ");
+    }
+    for(int y = 0;y<64;++y) {
+        for(int x = 0;x<128;++x) {
+            first_type::pixel_type value;
+            first.point(gfx::point16(x,y),&value);
+            const int lit = first.threshold_table()[value.native_value]!=0;
+            if(((b.gddram[y>>3][x]>>(y&7))&1)!=lit) {
+                fail("the mirror isn't the first panel's frame buffer");
+                y = 64;
+                break;
+            }
+        }
+    }
+    if(first.dirty()) {
+        fail("damage left after a mirror flush");
+    }
+
+    // a panel in temporal mode is skipped by every schedule
+    second.temporal_mode(ssd1306_temporal_mode::time_weighted);
+    const ssd1306_schedule schedules[] = {ssd1306_schedule::round_robin,ssd1306_schedule::priority};
+    for(int mirror = 0;mirror<2;++mirror) {
+        for(ssd1306_schedule schedule : schedules) {
+            group.mirror(mirror!=0);
+            group.schedule(schedule);
+            scribble(first,second);
+            start_trace();
+            group.flush();
+            order = selections("temporal");
+            for(int index : order) {
+                if(index!=0) {
+                    fail("a panel in temporal mode was selected");
+                    break;
+                }
+            }
+            if(order.empty() || first.dirty()) {
+                fail("the other panel wasn't flushed");
+            }
+        }
+    }
+    host_panel::tracing() = false;
+    if(failures) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+// flushes a grayscale display through ssd1306_pipeline after rounds of
+// random drawing, and a second display with the same drawing through a
+// plain flush(), to check the pipeline's ring hands over every packed
+// page once and in order. Build it under ThreadSanitizer with htcw_gfx on
+// the include path:
+//   c++ -std=c++14 -O1 -g -fsanitize=thread -pthread
+//       -I../ssd1306_shared_stress/host -I../../include -I<htcw_gfx>/src
+//       ssd1306_pipeline_check.cpp -o ssd1306_pipeline_check
+// It exits with 0 when every check passes
+#include <stdio.h>
+#include <tft_driver.hpp>
+#include <ssd1306_pipeline.hpp>
+using namespace arduino;
+using lcd_type = ssd1306<128,64,host_bus,0,4,0x3C>;
+using reference_type = ssd1306<128,64,host_bus,0,4,0x3D>;
+static int failures = 0;
+static void fail(const char* message) {
+    fprintf(stderr,"FAIL: %s\n",message);
+    ++failures;
+}
+// whether the panel shows the frame buffer thresholded through its table
+static bool matches(const lcd_type& lcd) {
+    const host_panel& panel = host_panel::at(0x3C);
+    for(int y = 0;y<64;++y) {
+        for(int x = 0;x<128;++x) {
+            lcd_type::pixel_type px;
+            lcd.point(gfx::point16(x,y),&px);
+            const int lit = lcd.threshold_table()[px.native_value]!=0;
+            if(((panel.gddram[y>>3][x]>>(y&7))&1)!=lit) {
+                fprintf(stderr,"pixel (%d, %d) differs\n",x,y);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+int main() {
+    static lcd_type lcd;
+    static reference_type reference;
+    if(lcd.initialize()!=gfx::gfx_result::success || reference.initialize()!=gfx::gfx_result::success) {
+        fail("initialize");
+        return 1;
+    }
+    lcd.update_mode(ssd1306_update_mode::manual);
+    reference.update_mode(ssd1306_update_mode::manual);
+    lcd.dithering(false);
+    reference.dithering(false);
+    lcd.threshold(8);
+    reference.threshold(8);
+    host_panel& panel = host_panel::at(0x3C);
+    host_panel& expected = host_panel::at(0x3D);
+    // a slow enough bus that the packing thread fills the ring and waits
+    host_panel::byte_time() = 200;
+    // two slots, so every page waits on the ring
+    ssd1306_pipeline<lcd_type> pipeline(lcd);
+    unsigned seed = 1;
+    size_t windows = 0, pages = 0;
+    for(int round = 0;round<200;++round) {
+        panel.windows.clear();
+        expected.windows.clear();
+        const int draws = 1+round%12;
+        for(int i = 0;i<draws;++i) {
+            seed = seed*1103515245+12345;
+            const int x = (seed>>8)&127, y = (seed>>20)&63;
+            const gfx::rect16 r(x,y,x+((seed>>4)&63),y+((seed>>12)&31));
+            lcd_type::pixel_type px;
+            px.native_value = (seed>>16)&15;
+            lcd.fill(r,px);
+            reference.fill(r,reference_type::pixel_type(px));
+        }
+        if(pipeline.flush()!=gfx::gfx_result::success) {
+            fail("flush");
+        }
+        reference.flush();
+        if(lcd.dirty()) {
+            fail("damage left after a pipeline flush");
+        }
+        if(panel.windows.size()!=expected.windows.size()) {
+            fprintf(stderr,"round %d sent %d windows instead of %d\n",round,(int)panel.windows.size(),(int)expected.windows.size());
+            fail("window count");
+            break;
+        }
+        for(size_t i = 0;i<panel.windows.size();++i) {
+            const host_panel::window& a = panel.windows[i];
+            const host_panel::window& b = expected.windows[i];
+            if(a.page!=b.page || a.x1!=b.x1 || a.x2!=b.x2 || a.bytes!=b.bytes) {
+                fprintf(stderr,"round %d window %d is page %d, columns %d-%d, %d bytes\n",round,(int)i,a.page,a.x1,a.x2,(int)a.bytes);
+                fail("window contents");
+                round = 200;
+                break;
+            }
+            ++windows;
+            pages+=a.bytes/(a.x2-a.x1+1);
+        }
+        // a page swapped or dropped in the ring shows up here
+        if(memcmp(panel.gddram,expected.gddram,sizeof(panel.gddram))!=0) {
+            fprintf(stderr,"round %d\n",round);
+            fail("the panels differ");
+            break;
+        }
+        if(!matches(lcd)) {
+            fail("panel contents");
+            break;
+        }
+    }
+    if(failures) {
+        return 1;
+    }
+    printf("OK: %d windows, %d pages through the ring\n",(int)windows,(int)pages);
+    return 0;
+}
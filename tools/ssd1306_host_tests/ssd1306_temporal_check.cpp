@@ -0,0 +1,143 @@
+// runs a 4-bit display in each temporal mode on a host panel that
+// integrates how long every pixel is lit, to check each gray level gets
+// its share of light, while other drawing and flushing, through the
+// display, a pipeline and a group, keeps off the panel. Build it with
+// htcw_gfx on the include path:
+//   c++ -std=c++14 -O2 -pthread -I../ssd1306_shared_stress/host
+//       -I../../include -I<htcw_gfx>/src ssd1306_temporal_check.cpp
+//       -o ssd1306_temporal_check
+// It exits with 0 when every check passes
+#include <stdio.h>
+#include <math.h>
+#include <tft_driver.hpp>
+#include <ssd1306_group.hpp>
+#include <ssd1306_pipeline.hpp>
+using namespace arduino;
+using lcd_type = ssd1306<128,64,host_bus,0,4,0x3C>;
+using other_type = ssd1306<128,64,host_bus,0,4,0x3D>;
+static int failures = 0;
+static void fail(const char* message) {
+    fprintf(stderr,"FAIL: %s\n",message);
+    ++failures;
+}
+// how far a level's share of the light may be from its weight. The host
+// may preempt us in the middle of a plane
+constexpr static const double tolerance = 0.03;
+static void check(lcd_type& lcd,other_type& other,ssd1306_temporal_mode mode,const char* name,int cycles) {
+    host_panel& panel = host_panel::at(0x3C);
+    ssd1306_pipeline<lcd_type> pipeline(lcd);
+    // lcd is the mirror source in one group and a target in the other
+    ssd1306_group<lcd_type,other_type> group(lcd,other);
+    ssd1306_group<other_type,lcd_type> mirror(other,lcd);
+    mirror.mirror(true);
+    lcd_type::pixel_type px;
+    // a band of each gray level across the top half
+    for(int v = 0;v<16;++v) {
+        px.native_value = v;
+        lcd.fill(gfx::rect16(v*8,0,v*8+7,31),px);
+    }
+    lcd.temporal_mode(mode);
+    panel.windows.clear();
+    // integrate whole cycles, from plane 0 going up to plane 0 coming back
+    size_t planes = 0;
+    unsigned seed = 1;
+    bool integrating = false;
+    for(int i = 0;;++i) {
+        lcd.service();
+        if(panel.windows.size()!=planes) {
+            planes = panel.windows.size();
+            if(planes%4==0) {
+                if(planes==size_t(cycles*4)) {
+                    panel.integrate(false);
+                    break;
+                }
+                if(!integrating) {
+                    panel.integrate(true);
+                    integrating = true;
+                }
+            }
+        }
+        // everything else that sends must leave the panel alone
+        if(integrating && i%64==0) {
+            seed = seed*1103515245+12345;
+            const int x = (seed>>8)&127, y = 32+((seed>>20)&31);
+            px.native_value = (seed>>16)&15;
+            lcd.fill(gfx::rect16(x,y,x+7,y+3),px);
+            other.fill(gfx::rect16(x,y,x+7,y+3),other_type::pixel_type(px));
+            switch((seed>>4)&7) {
+                case 0:
+                    lcd.flush();
+                    break;
+                case 1:
+                    lcd.flush_some(200);
+                    break;
+                case 2:
+                    lcd.flush_until(micros()+50);
+                    break;
+                case 3:
+                    pipeline.flush();
+                    break;
+                case 4:
+                    group.flush();
+                    break;
+                case 5:
+                    mirror.flush();
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    // each panel window must be a whole plane
+    for(const host_panel::window& w : panel.windows) {
+        if(w.page!=0 || w.x1!=0 || w.x2!=127 || w.bytes!=128*8) {
+            fprintf(stderr,"%s: a window of page %d, columns %d-%d, %d bytes\n",name,w.page,w.x1,w.x2,(int)w.bytes);
+            fail("a partial window reached a panel in temporal mode");
+            break;
+        }
+    }
+    double full = 0;
+    for(int y = 0;y<32;++y) {
+        full+=panel.level(127,y);
+    }
+    full/=32;
+    double worst = 0;
+    for(int v = 0;v<16;++v) {
+        double sum = 0;
+        for(int y = 0;y<32;++y) {
+            for(int x = v*8;x<v*8+8;++x) {
+                sum+=panel.level(x,y);
+            }
+        }
+        const double share = sum/(8*32)/full;
+        const double error = fabs(share-v/15.0);
+        if(error>worst) {
+            worst = error;
+        }
+        if(error>tolerance) {
+            fprintf(stderr,"%s: level %d gets %.3f of the light, not %.3f\n",name,v,share,v/15.0);
+            fail("duty cycle");
+        }
+    }
+    lcd.temporal_mode(ssd1306_temporal_mode::off);
+    if(lcd.dirty()) {
+        fail("damage left after leaving temporal mode");
+    }
+    printf("%s: %d cycles, shares within %.3f\n",name,cycles,worst);
+}
+int main() {
+    static lcd_type lcd;
+    static other_type other;
+    if(lcd.initialize()!=gfx::gfx_result::success || other.initialize()!=gfx::gfx_result::success) {
+        fail("initialize");
+        return 1;
+    }
+    lcd.temporal_period(1000);
+    check(lcd,other,ssd1306_temporal_mode::time_weighted,"time weighted",20);
+    check(lcd,other,ssd1306_temporal_mode::contrast_weighted,"contrast weighted",75);
+    if(failures) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,34 @@
+// just enough of the Arduino API to build the driver on a host
+#ifndef HTCW_SSD1306_HOST_ARDUINO_H
+#define HTCW_SSD1306_HOST_ARDUINO_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#define PROGMEM
+#define HIGH 1
+#define LOW 0
+inline void digitalWrite(int pin,int value) {
+    (void)pin;
+    (void)value;
+}
+inline void pinMode(int pin,int mode) {
+    (void)pin;
+    (void)mode;
+}
+inline unsigned long micros() {
+    using namespace std::chrono;
+    return (unsigned long)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+inline unsigned long millis() {
+    return micros()/1000;
+}
+inline void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+inline uint8_t pgm_read_byte(const uint8_t* p) {
+    return *p;
+}
+#endif // HTCW_SSD1306_HOST_ARDUINO_H
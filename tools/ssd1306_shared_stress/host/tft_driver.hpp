@@ -0,0 +1,240 @@
+// a panel driver for the host that keeps the bytes sent to it in an
+// emulated GDDRAM, in horizontal addressing mode, so a test can check
+// what reached the panel. There is one emulated panel per address
+#ifndef HTCW_SSD1306_HOST_TFT_DRIVER_HPP
+#define HTCW_SSD1306_HOST_TFT_DRIVER_HPP
+#include <Arduino.h>
+#include <chrono>
+#include <map>
+#include <vector>
+namespace arduino {
+    struct host_panel {
+        // an address window and the data bytes sent to it
+        struct window {
+            int page;
+            int x1;
+            int x2;
+            size_t bytes;
+        };
+        uint8_t gddram[8][128];
+        uint8_t contrast;
+        uint8_t start_line;
+        // 0xAF commands, one per init sequence
+        size_t display_ons;
+        size_t data_bytes;
+        std::vector<window> windows;
+        // while integrating, how long each pixel has been lit, in
+        // microseconds times contrast, and the microseconds integrated
+        bool integrating;
+        std::vector<double> lit;
+        double elapsed;
+        host_panel() {
+            reset();
+        }
+        void reset() {
+            memset(gddram,0,sizeof(gddram));
+            contrast = 0;
+            start_line = 0;
+            display_ons = 0;
+            data_bytes = 0;
+            windows.clear();
+            integrating = false;
+            lit.assign(8*128*8,0);
+            elapsed = 0;
+            m_timestamp = 0;
+            m_cmd = 0;
+            m_arg = 0;
+            m_count = 0;
+            m_page = m_page_start = 0;
+            m_page_end = 7;
+            m_column = m_column_start = 0;
+            m_column_end = 127;
+        }
+        // starts accumulating lit time from now, or stops and keeps what
+        // was accumulated
+        void integrate(bool value) {
+            if(value) {
+                lit.assign(8*128*8,0);
+                elapsed = 0;
+                m_timestamp = micros();
+            } else {
+                sample();
+            }
+            integrating = value;
+        }
+        // how lit a pixel was on average while integrating, from 0 to 255
+        double level(int x,int y) const {
+            return elapsed>0?lit[((y>>3)*128+x)*8+(y&7)]/elapsed:0;
+        }
+        // the argument bytes each command the driver sends takes
+        static int arguments(uint8_t cmd) {
+            switch(cmd) {
+                case 0x21:
+                case 0x22:
+                    return 2;
+                case 0x20:
+                case 0x81:
+                case 0x8D:
+                case 0xA8:
+                case 0xD3:
+                case 0xD5:
+                case 0xD9:
+                case 0xDA:
+                case 0xDB:
+                    return 1;
+                default:
+                    return 0;
+            }
+        }
+        void command(uint8_t value) {
+            sample();
+            if(m_arg==m_count) {
+                m_cmd = value;
+                m_arg = 0;
+                m_count = arguments(m_cmd);
+                if(m_cmd==0xAF) {
+                    ++display_ons;
+                } else if(m_cmd>=0x40 && m_cmd<=0x7F) {
+                    start_line = m_cmd&0x3F;
+                }
+                return;
+            }
+            if(m_cmd==0x21) {
+                (m_arg==0?m_column_start:m_column_end) = value&127;
+                m_column = m_column_start;
+                if(m_arg==1) {
+                    windows.push_back(window{m_page_start,m_column_start,m_column_end,0});
+                }
+            } else if(m_cmd==0x22) {
+                (m_arg==0?m_page_start:m_page_end) = value&7;
+                m_page = m_page_start;
+            } else if(m_cmd==0x81) {
+                contrast = value;
+            }
+            ++m_arg;
+        }
+        void data(uint8_t value) {
+            gddram[m_page][m_column] = value;
+            ++data_bytes;
+            if(!windows.empty()) {
+                ++windows.back().bytes;
+            }
+            if(++m_column>m_column_end) {
+                m_column = m_column_start;
+                if(++m_page>m_page_end) {
+                    m_page = m_page_start;
+                }
+            }
+        }
+        // the panel at an I2C address
+        static host_panel& at(uint8_t address) {
+            static std::map<uint8_t,host_panel> panels;
+            return panels[address];
+        }
+        // while tracing, the address of every transfer, in order. Tests
+        // may add their own markers
+        static bool& tracing() {
+            static bool result = false;
+            return result;
+        }
+        static std::vector<int>& trace() {
+            static std::vector<int> result;
+            return result;
+        }
+        static void record(uint8_t address) {
+            if(tracing()) {
+                trace().push_back(address);
+            }
+        }
+        // the nanoseconds each byte takes on the emulated bus
+        static uint32_t& byte_time() {
+            static uint32_t result = 0;
+            return result;
+        }
+        static void wait_bytes(size_t size) {
+            if(byte_time()==0) {
+                return;
+            }
+            using namespace std::chrono;
+            const steady_clock::time_point end = steady_clock::now()+nanoseconds(uint64_t(byte_time())*size);
+            while(steady_clock::now()<end) {
+            }
+        }
+    private:
+        uint8_t m_cmd;
+        int m_arg;
+        int m_count;
+        int m_page;
+        int m_page_start;
+        int m_page_end;
+        int m_column;
+        int m_column_start;
+        int m_column_end;
+        unsigned long m_timestamp;
+        // credits the time since the last sample to the pixels lit in it
+        void sample() {
+            if(!integrating) {
+                return;
+            }
+            const unsigned long now = micros();
+            const double dt = double(now-m_timestamp);
+            m_timestamp = now;
+            elapsed+=dt;
+            const double weight = dt*contrast;
+            for(int page = 0;page<8;++page) {
+                for(int x = 0;x<128;++x) {
+                    const uint8_t b = gddram[page][x];
+                    for(int bit = 0;bit<8;++bit) {
+                        if(b&(1<<bit)) {
+                            lit[(page*128+x)*8+bit]+=weight;
+                        }
+                    }
+                }
+            }
+        }
+    };
+    template<int8_t PinDC,int8_t PinRst,int8_t PinBL,typename Bus,int8_t SoftReset,uint8_t Address,uint8_t CommandPrefix,uint8_t DataPrefix>
+    struct tft_driver {
+        static host_panel& panel() {
+            static host_panel& result = host_panel::at(Address);
+            return result;
+        }
+        static bool initialize() {
+            return true;
+        }
+        static void send_command(const uint8_t* data,size_t size) {
+            host_panel::record(Address);
+            host_panel::wait_bytes(size);
+            while(size--) {
+                panel().command(*data++);
+            }
+        }
+        static void send_data(const uint8_t* data,size_t size) {
+            host_panel::record(Address);
+            host_panel::wait_bytes(size);
+            while(size--) {
+                panel().data(*data++);
+            }
+        }
+        static void send_command_pgm(const uint8_t* data,size_t size) {
+            send_command(data,size);
+        }
+        static void send_data_pgm(const uint8_t* data,size_t size) {
+            send_data(data,size);
+        }
+    };
+    struct host_bus {
+        static void set_speed_multiplier(float value) {
+            (void)value;
+        }
+        static void begin_initialization() {
+        }
+        static void end_initialization() {
+        }
+        static void begin_write() {
+        }
+        static void end_write() {
+        }
+    };
+}
+#endif // HTCW_SSD1306_HOST_TFT_DRIVER_HPP
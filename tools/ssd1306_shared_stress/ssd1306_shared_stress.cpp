@@ -0,0 +1,139 @@
+// hammers ssd1306_shared from several producer threads at once while the
+// owner drains and flushes, to validate the queue and the page locks.
+// Build it under ThreadSanitizer with htcw_gfx on the include path:
+//   c++ -std=c++14 -O1 -g -fsanitize=thread -pthread -Ihost -I../../include
+//       -I<htcw_gfx>/src ssd1306_shared_stress.cpp -o ssd1306_shared_stress
+// It exits with 0 when every command arrived exactly once, the panel
+// holds what was drawn, and waits give up after the timeout
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <tft_driver.hpp>
+#include <ssd1306_shared.hpp>
+using namespace arduino;
+using lcd_type = ssd1306<128,64,host_bus>;
+using shared_type = ssd1306_shared<lcd_type,16>;
+// each producer owns a band of columns and sets every pixel in it once
+constexpr static const int producers = 4;
+// direct drawers fill their own rows of the bottom half under a page lock
+constexpr static const int drawers = 2;
+constexpr static const int band = 128/producers;
+constexpr static const int rounds = 200;
+static int failures = 0;
+static void fail(const char* message) {
+    fprintf(stderr,"FAIL: %s\n",message);
+    ++failures;
+}
+int main() {
+    static lcd_type lcd;
+    if(lcd.initialize()!=gfx::gfx_result::success) {
+        fail("initialize");
+        return 1;
+    }
+    shared_type shared(lcd);
+    lcd_type::pixel_type white;
+    white.native_value = 1;
+    std::atomic<int> running(producers+drawers);
+    std::vector<std::thread> threads;
+    for(int p = 0;p<producers;++p) {
+        threads.emplace_back([&shared,&running,white,p]() {
+            // the top half, one point per command
+            for(int y = 0;y<32;++y) {
+                for(int x = 0;x<band;++x) {
+                    if(shared.point(gfx::point16(p*band+x,y),white)!=gfx::gfx_result::success) {
+                        fail("post timed out");
+                    }
+                }
+            }
+            --running;
+        });
+    }
+    for(int d = 0;d<drawers;++d) {
+        threads.emplace_back([&shared,&running,white,d]() {
+            // 16 rows each, straddling pages so locks overlap the
+            // owner's flush
+            const gfx::srect16 region(0,32+d*16,127,47+d*16);
+            for(int i = 0;i<rounds;++i) {
+                shared_type::page_lock lock(shared,region);
+                if(lock.result()!=gfx::gfx_result::success) {
+                    fail("page lock timed out");
+                    continue;
+                }
+                lcd_type::pixel_type px;
+                px.native_value = i&1;
+                shared.display().fill((gfx::rect16)region,px);
+            }
+            shared_type::page_lock lock(shared,region);
+            if(lock.result()!=gfx::gfx_result::success) {
+                fail("page lock timed out");
+            }
+            shared.display().fill((gfx::rect16)region,white);
+            --running;
+        });
+    }
+    // the owner
+    size_t processed = 0;
+    while(running>0) {
+        processed+=shared.process();
+        shared.flush();
+    }
+    for(std::thread& t : threads) {
+        t.join();
+    }
+    processed+=shared.process();
+    shared.flush();
+    if(processed!=size_t(128*32)) {
+        fprintf(stderr,"processed %d commands, expected %d\n",(int)processed,128*32);
+        fail("command count");
+    }
+    if(lcd.dirty()) {
+        fail("damage left after the last flush");
+    }
+    for(int page = 0;page<8;++page) {
+        for(int x = 0;x<128;++x) {
+            if(host_panel::at(0x3C).gddram[page][x]!=0xFF) {
+                fprintf(stderr,"page %d column %d is 0x%02X\n",page,x,host_panel::at(0x3C).gddram[page][x]);
+                fail("panel contents");
+                page = 8;
+                break;
+            }
+        }
+    }
+    // with nobody draining or unlocking, waits give up
+    shared.timeout(5);
+    for(size_t i = 0;i<16;++i) {
+        shared.point(gfx::point16(0,0),white);
+    }
+    if(shared.point(gfx::point16(0,0),white)!=gfx::gfx_result::canceled) {
+        fail("post to a full queue didn't time out");
+    }
+    {
+        shared_type::page_lock held(shared,gfx::srect16(0,0,127,7));
+        shared_type::page_lock other(shared,gfx::srect16(0,0,0,0));
+        if(other.result()!=gfx::gfx_result::canceled) {
+            fail("a held page was locked twice");
+        }
+        if(shared.process()!=0) {
+            fail("a command was applied to a locked page");
+        }
+        lcd_type::pixel_type black;
+        shared.display().fill(gfx::rect16(0,8,0,8),black);
+        // the locked page is skipped, the rest are sent
+        if(shared.flush()!=gfx::gfx_result::canceled || host_panel::at(0x3C).gddram[1][0]!=0xFE) {
+            fail("flush didn't send around a locked page");
+        }
+        shared.display().fill(gfx::rect16(0,0,0,0),black);
+        if(shared.flush()!=gfx::gfx_result::canceled || !lcd.dirty()) {
+            fail("flush of a locked page didn't time out");
+        }
+    }
+    if(shared.process()!=16) {
+        fail("commands were lost while pages were locked");
+    }
+    if(failures) {
+        return 1;
+    }
+    printf("OK: %d producers, %d direct drawers, %d commands\n",producers,drawers,(int)processed);
+    return 0;
+}